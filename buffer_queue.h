@@ -0,0 +1,150 @@
+#ifndef __BUFFER_QUEUE
+#define __BUFFER_QUEUE
+
+#include <cstdlib>
+#include <cstdint>
+#include <unistd.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <new>
+
+
+/**
+ * A bounded queue of buffers, to hand data from one thread (the producer) to
+ * another (the consumer) without allocating memory: a fixed set of page-aligned
+ * buffers goes round from the free list to the producer, to the queue, to the
+ * consumer and back to the free list.
+ *
+ * The producer waits for a free buffer when all of them are queued or in use; the
+ * time it waits (stall) and the depth of the queue are counted.
+ */
+template <typename T> class buffer_queue {
+public:
+    struct buffer {
+        T*     data;      ///< 'capacity' elements >.
+        size_t n;         ///< how many are used >.
+    };
+
+    struct stats_t {
+        size_t   max_depth=0;     ///< max number of buffers queued >.
+        uint64_t stalls=0;        ///< how many times the producer waited for a free buffer >.
+        uint64_t stall_ns=0;      ///< how long it waited in total >.
+    };
+
+    buffer_queue(
+                 size_t n_buffers, ///< how many buffers >.
+                 size_t capacity   ///< elements per buffer >.
+                ) : cap(capacity)
+    {
+        size_t page=sysconf(_SC_PAGESIZE);
+        for (size_t k=0;k<n_buffers;k++) {
+            void *p;
+            if (posix_memalign(&p,page,capacity*sizeof(T))!=0)
+                throw std::bad_alloc();
+            all.push_back(static_cast<T*>(p));
+            free_list.push_back(buffer{static_cast<T*>(p),0});
+        }
+    }
+
+    ~buffer_queue()
+    {
+        for (auto p : all)
+            free(p);
+    }
+
+    buffer_queue(const buffer_queue&) = delete;
+    buffer_queue& operator=(const buffer_queue&) = delete;
+
+    size_t capacity() const { return cap; }
+    size_t size() const { return all.size(); }
+
+    /// Producer: gets a free buffer, waiting if there are none
+    buffer get_free()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (free_list.empty()) {
+            auto t0=std::chrono::steady_clock::now();
+            free_cond.wait(lock,[this] { return !free_list.empty(); });
+            st.stalls++;
+            st.stall_ns+=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-t0).count();
+        }
+        buffer b=free_list.back();
+        free_list.pop_back();
+        return b;
+    }
+
+    /// Producer: queues a buffer for the consumer
+    void push(buffer b)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(b);
+            if (queue.size()>st.max_depth)
+                st.max_depth=queue.size();
+        }
+        queue_cond.notify_one();
+    }
+
+    /// Producer: no more buffers will be queued
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed=true;
+        }
+        queue_cond.notify_one();
+    }
+
+    /// Consumer: gets the next buffer, waiting for it. Returns false when the
+    /// queue is closed and empty
+    bool pop(buffer& b)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        queue_cond.wait(lock,[this] { return closed || !queue.empty(); });
+        if (queue.empty())
+            return false;
+        b=queue.front();
+        queue.pop_front();
+        return true;
+    }
+
+    /// Consumer: gives back a buffer when done with it
+    void release(buffer b)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            b.n=0;
+            free_list.push_back(b);
+        }
+        free_cond.notify_one();
+    }
+
+    size_t depth()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.size();
+    }
+
+    stats_t stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return st;
+    }
+
+private:
+    size_t              cap;
+    std::vector<T*>     all;
+    std::vector<buffer> free_list;
+    std::deque<buffer>  queue;
+    bool                closed=false;
+    stats_t             st;
+
+    std::mutex              mutex;
+    std::condition_variable free_cond;
+    std::condition_variable queue_cond;
+};
+
+#endif
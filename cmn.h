@@ -1,6 +1,8 @@
 #ifndef __CMN_H
 #define __CMN_H
 
+#include <cmath>
+#include <cstring>
 #include "swmr_ringbuffer.h"
 
 // Common definitions for the generator/transformer/reader example code
@@ -10,11 +12,11 @@
 static const unsigned int POINTS_PER_SEC=1000000;
 
 
-/// How many seconds we want to be able to buffer
+/// How many seconds we want to be able to buffer (by default)
 static const unsigned int BUF_DEPTH_SEC=10;
 
-// Size of the buffer in data points
-static const unsigned int BUF_SIZE=BUF_DEPTH_SEC*POINTS_PER_SEC;
+// Default size of the buffers in data points (setup can choose a different size)
+static const uint64_t BUF_SIZE=BUF_DEPTH_SEC*POINTS_PER_SEC;
 
 
 // Names to open/create the interprocess communication structures:
@@ -24,10 +26,18 @@ static const char* RINGBUF_NAME1="RING_BUFFER1";
 static const char* RINGBUF_NAME2="RING_BUFFER2";
 
 
-// All HDF5 files will use a dataset with this name
+// All HDF5 files will use a dataset with this name (or, with one dataset per
+// channel, this name followed by '_' and the channel number)
 static const char* DATASET_NAME="dset";
 
 
+// Name of the number of channels, in the shared memory segment (written by setup).
+// The ring buffers carry frames of this many data points (one per channel,
+// interleaved): frame 'f' holds the points 'f*channels' to 'f*channels+channels-1'
+// of the sequence. All the writes, reads and sizes are whole frames.
+static const char* CHANNELS_NAME="CHANNELS";
+
+
 
 
 /// Type of the data points we are generating and saving on file
@@ -43,6 +53,74 @@ data_point_t generate(size_t k)
 }
 
 
+/**
+ * Max difference between the points of generate_batch() and generate(), for points
+ * up to 10^10 (almost 3 hours at POINTS_PER_SEC). It grows with the index of the
+ * point, as the rounding of the phase in generate() does: it is 6e-12 for the first
+ * points, 3e-9 after 10 minutes.
+ */
+static const double GENERATE_BATCH_TOLERANCE=1e-7;
+
+// generate_batch() is compiled for AVX-512, AVX2 and the baseline instruction set,
+// and the version for the CPU is chosen when the program starts
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define GENERATE_TARGET_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define GENERATE_TARGET_CLONES
+#endif
+
+/**
+ * Generates 'n' points of the sequence from point 'k0', in 'out'.
+ * The same as calling generate() for each point, but without the sin() and cos()
+ * per point: for 8 points at a time (vectorized) the phases are rotated by a
+ * recurrence (angle addition), re-anchored with sin()/cos() every
+ * 1024 points so the rounding errors don't build up. The points differ from
+ * those of generate() by less than GENERATE_BATCH_TOLERANCE.
+ */
+GENERATE_TARGET_CLONES
+void generate_batch(size_t k0,size_t n,data_point_t* out)
+{
+    typedef double v8d __attribute__((vector_size(8*sizeof(double))));
+    const size_t LANES=8;
+    const size_t ANCHOR=1024;      // points between two re-anchors (multiple of LANES)
+
+    // Rotation of the phases by LANES points
+    const double ds1=sin(0.01*LANES),  dc1=cos(0.01*LANES);
+    const double ds2=sin(0.001*LANES), dc2=cos(0.001*LANES);
+
+    for (size_t b=0;b<n;b+=ANCHOR) {
+        size_t nb=(n-b<ANCHOR)? n-b : ANCHOR;
+        size_t k=k0+b;
+        size_t m=0;
+
+        if (nb>=LANES) {
+            // Each lane starts from the exact phase of its point
+            v8d s1,c1,s2,c2;
+            for (size_t l=0;l<LANES;l++) {
+                double t=0.01*(k+l);
+                s1[l]=sin(t);
+                c1[l]=cos(t);
+                s2[l]=sin(t/10);
+                c2[l]=cos(t/10);
+            }
+            for (;m+LANES<=nb;m+=LANES) {
+                v8d y=2.78*s1+3.14*c2;
+                memcpy(out+b+m,&y,sizeof(y));
+
+                v8d s=s1*dc1+c1*ds1;
+                c1=c1*dc1-s1*ds1;
+                s1=s;
+                s=s2*dc2+c2*ds2;
+                c2=c2*dc2-s2*ds2;
+                s2=s;
+            }
+        }
+        for (;m<nb;m++)
+            out[b+m]=generate(k+m);
+    }
+}
+
+
 /**
  * Transforms point 'k' in the sequence
  */
@@ -53,13 +131,26 @@ data_point_t transform(size_t k,data_point_t x)
 
 
 
-// How many readers can read from the same ring buffer
+// How many readers can read from the same ring buffer (by default: setup can
+// choose a different number)
 static const unsigned int MAX_READERS=2;
 
 
+/**
+ * Returns the number of channels of the ring buffers in 'segment' (1 if setup did
+ * not choose it).
+ */
+template <typename SEGMENT>
+unsigned int get_channels(SEGMENT& segment)
+{
+    auto found=segment.template find_no_lock<uint32_t>(CHANNELS_NAME);
+    return found.first? *found.first : 1;
+}
+
+
 // Just a shorthand for the ring buffer type. Note that size and max
-// number of reader is fixed at compile time
-typedef swmr_ringbuffer<data_point_t,BUF_SIZE,MAX_READERS> shm_ringbuf;
+// number of readers are chosen at run time by setup
+typedef swmr_ringbuffer<data_point_t> shm_ringbuf;
 
 
 
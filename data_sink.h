@@ -0,0 +1,421 @@
+#ifndef __DATA_SINK
+#define __DATA_SINK
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <stdexcept>
+
+#include "H5Cpp.h"
+
+#include "h5_chunk_writer.h"
+
+
+/**
+ * A file where a stream of frames of elements of type T is stored, as done by the
+ * reader: open() creates the file, append() adds frames at its end and close()
+ * completes it. A file can be created in advance, and deleted with discard() if
+ * it is not needed. A frame is made of one element per channel.
+ *
+ * The frames appended come with their index in the stream, so that the position
+ * of the data in the stream is kept in the file.
+ */
+template <typename T> class data_sink {
+public:
+    virtual ~data_sink() {}
+
+    /// Creates the file 'name' + extension()
+    virtual void open(const std::string& name)=0;
+
+    /// Appends 'n' frames ('n' x channels() elements), the first of which is frame
+    /// 'index' of the stream
+    virtual void append(const T* data,size_t n,uint64_t index)=0;
+
+    /// Elements per frame
+    virtual unsigned int channels() const=0;
+
+    /// Bytes stored in the file so far
+    virtual uint64_t bytes_stored() const=0;
+
+    /// Completes and closes the file
+    virtual void close()=0;
+
+    /// Closes and deletes the file
+    virtual void discard()=0;
+
+    /// The full name of the file
+    virtual std::string file_name() const=0;
+
+    virtual const char* extension() const=0;
+};
+
+
+/// Name of the type of the elements, in the raw files
+template <typename T> struct raw_dtype;
+template <> struct raw_dtype<double>   { static const char* name() { return "f64le"; } };
+template <> struct raw_dtype<float>    { static const char* name() { return "f32le"; } };
+template <> struct raw_dtype<int16_t>  { static const char* name() { return "i16le"; } };
+template <> struct raw_dtype<int32_t>  { static const char* name() { return "i32le"; } };
+template <> struct raw_dtype<int64_t>  { static const char* name() { return "i64le"; } };
+template <> struct raw_dtype<uint16_t> { static const char* name() { return "u16le"; } };
+template <> struct raw_dtype<uint32_t> { static const char* name() { return "u32le"; } };
+
+
+/**
+ * The header at the start of a raw file. The frames follow it (the channels of
+ * each frame are interleaved).
+ * 'n_frames' is written when the file is closed: if it is 0 the file was not
+ * closed, and the number of frames is given by the size of the file.
+ */
+struct raw_header {
+    char     magic[8];        ///< RAW_MAGIC >.
+    uint32_t header_size;     ///< where the data starts >.
+    uint32_t elem_size;       ///< bytes per element >.
+    char     dtype[16];       ///< type of the elements (see raw_dtype) >.
+    double   sample_rate;     ///< frames per second >.
+    uint64_t first_index;     ///< index in the stream of the first frame >.
+    uint64_t n_frames;        ///< number of frames >.
+    uint32_t channels;        ///< elements per frame (0 in old files: 1) >.
+    uint32_t reserved;
+};
+static_assert(sizeof(raw_header)==64,"raw_header must be 64 bytes");
+
+static const char RAW_MAGIC[8]={'R','B','R','A','W','0','0','1'};
+
+/**
+ * An entry of the sidecar index of a raw file (file name + ".idx"): one for each
+ * append(), to find the data of a given index or time.
+ */
+struct raw_index_entry {
+    uint64_t first_index;     ///< index in the stream of the first frame appended >.
+    uint64_t offset;          ///< offset in the file of the first frame >.
+    uint64_t n_frames;        ///< how many frames >.
+    int64_t  time_ns;         ///< when they were appended (system clock, ns from the epoch) >.
+};
+
+
+/// How the channels are stored in an HDF5 file
+enum class h5_layout {
+    interleaved,    ///< one 2-D dataset [samples x channels] (1-D with one channel) >.
+    per_channel     ///< one 1-D dataset per channel, named as the dataset + "_<channel>" >.
+};
+
+
+/**
+ * Stores the stream in an HDF5 file, with extensible chunked datasets written
+ * by h5_chunk_writer. The index of the first frame and the sample rate are
+ * attributes of each dataset.
+ *
+ * With the per_channel layout the frames are transposed (SoA) one block of frames
+ * at a time, a block small enough to stay in the L1 cache while its channels are
+ * copied to their datasets.
+ *
+ * With set_swmr() the file is written in HDF5 SWMR mode (latest file format): once
+ * the first data is appended, other processes can open the file with
+ * H5F_ACC_SWMR_READ and read the data while it is written. The datasets are flushed
+ * periodically, so the readers see the data written up to the last flush.
+ */
+template <typename T> class h5_sink : public data_sink<T> {
+public:
+    /// Bytes of frames transposed at a time with the per_channel layout
+    static const size_t TRANSPOSE_BLOCK_BYTES=16384;
+
+    h5_sink(
+            const char* dataset_name,      ///< name of the dataset >.
+            const H5::DataType& file_type, ///< type of the elements in the file (the same layout as T) >.
+            double sample_rate,            ///< frames per second >.
+            size_t chunk_frames,           ///< frames per chunk >.
+            const h5_filters& filters,     ///< filters to apply to the chunks >.
+            worker_pool& pool,             ///< the threads that apply the filters >.
+            unsigned int channels=1,       ///< elements per frame >.
+            h5_layout layout=h5_layout::interleaved ///< how the channels are stored >.
+           ) : dataset_name(dataset_name), file_type(file_type), sample_rate(sample_rate),
+               n_channels(channels), layout(layout)
+    {
+        if (layout==h5_layout::per_channel) {
+            for (unsigned int c=0;c<channels;c++)
+                writers.emplace_back(new h5_chunk_writer<T>(chunk_frames,filters,pool));
+        } else
+            writers.emplace_back(new h5_chunk_writer<T>(chunk_frames,filters,pool,channels));
+    }
+
+    /// Writes the files in SWMR mode, flushing the data every 'flush_msec' at least
+    void set_swmr(unsigned int flush_msec)
+    {
+        swmr=true;
+        flush_interval=std::chrono::milliseconds(flush_msec);
+    }
+
+    unsigned int channels() const override { return n_channels; }
+
+    void open(const std::string& name) override
+    {
+        fname=name+extension();
+        H5::FileAccPropList fapl;
+        if (swmr)
+            fapl.setLibverBounds(H5F_LIBVER_LATEST,H5F_LIBVER_LATEST);
+        file.reset(new H5::H5File(fname,H5F_ACC_TRUNC,H5::FileCreatPropList::DEFAULT,fapl));
+
+        // The datasets start empty and have no max size
+        int     rank=(layout==h5_layout::interleaved && n_channels>1)? 2 : 1;
+        hsize_t dim[2]={0,n_channels};
+        hsize_t maxdim[2]={H5S_UNLIMITED,n_channels};
+        H5::DataSpace dataspace(rank,dim,maxdim);
+        datasets.clear();
+        for (size_t k=0;k<writers.size();k++) {
+            H5::DSetCreatPropList plist;
+            writers[k]->set_create_props(plist);
+            std::string dname=dataset_name;
+            if (layout==h5_layout::per_channel)
+                dname+="_"+std::to_string(k);
+            datasets.push_back(file->createDataSet(dname,file_type,dataspace,plist));
+            writers[k]->start(datasets.back());
+        }
+        first_index=0;
+        n_frames=0;
+    }
+
+    void append(const T* data,size_t n,uint64_t index) override
+    {
+        if (n_frames==0) {
+            // The attributes are written as soon as they are known: in SWMR mode
+            // no attribute can be added after starting
+            first_index=index;
+            write_attributes();
+            if (swmr) {
+                if (H5Fstart_swmr_write(file->getId())<0)
+                    throw std::runtime_error("h5_sink: can't start SWMR mode for "+fname);
+                last_flush=std::chrono::steady_clock::now();
+            }
+        }
+
+        if (layout==h5_layout::interleaved) {
+            T *dest=writers[0]->append_begin(n);
+            std::copy(data,data+n*n_channels,dest);
+            writers[0]->append_end(n);
+        } else {
+            // Transpose one block of frames at a time: each channel of the block
+            // is copied in its dataset
+            std::vector<T*> dest(n_channels);
+            for (unsigned int c=0;c<n_channels;c++)
+                dest[c]=writers[c]->append_begin(n);
+            size_t block=TRANSPOSE_BLOCK_BYTES/(n_channels*sizeof(T));
+            if (block==0)
+                block=1;
+            for (size_t f0=0;f0<n;f0+=block) {
+                size_t nf=std::min(block,n-f0);
+                const T *src=data+f0*n_channels;
+                for (unsigned int c=0;c<n_channels;c++) {
+                    T *d=dest[c]+f0;
+                    for (size_t f=0;f<nf;f++)
+                        d[f]=src[f*n_channels+c];
+                }
+            }
+            for (auto &w : writers)
+                w->append_end(n);
+        }
+        n_frames+=n;
+
+        if (swmr && std::chrono::steady_clock::now()-last_flush>=flush_interval) {
+            for (auto &d : datasets) {
+                if (H5Dflush(d.getId())<0)
+                    throw std::runtime_error("h5_sink: can't flush "+fname);
+            }
+            last_flush=std::chrono::steady_clock::now();
+        }
+    }
+
+    uint64_t bytes_stored() const override
+    {
+        uint64_t n=0;
+        for (auto &w : writers)
+            n+=w->bytes_written();
+        return n;
+    }
+
+    void close() override
+    {
+        for (auto &w : writers)
+            w->finish();
+        if (n_frames==0)
+            write_attributes();
+        datasets.clear();
+        file->close();
+        file.reset();
+    }
+
+    void discard() override
+    {
+        datasets.clear();
+        file->close();
+        file.reset();
+        std::remove(fname.c_str());
+    }
+
+    std::string file_name() const override { return fname; }
+    const char* extension() const override { return ".h5"; }
+
+private:
+    void write_attributes()
+    {
+        H5::DataSpace scalar;
+        for (auto &d : datasets) {
+            d.createAttribute("first_index",H5::PredType::STD_U64LE,scalar).write(H5::PredType::NATIVE_UINT64,&first_index);
+            d.createAttribute("sample_rate",H5::PredType::IEEE_F64LE,scalar).write(H5::PredType::NATIVE_DOUBLE,&sample_rate);
+        }
+    }
+
+    std::string  dataset_name;
+    H5::DataType file_type;
+    double       sample_rate;
+    unsigned int n_channels;
+    h5_layout    layout;
+    std::vector<std::unique_ptr<h5_chunk_writer<T>>> writers;   // one per dataset
+
+    std::string  fname;
+    std::unique_ptr<H5::H5File> file;
+    std::vector<H5::DataSet> datasets;
+    uint64_t     first_index=0;
+    uint64_t     n_frames=0;
+
+    bool         swmr=false;
+    std::chrono::steady_clock::duration   flush_interval;
+    std::chrono::steady_clock::time_point last_flush;
+};
+
+
+/**
+ * Stores the stream in a raw binary file: a raw_header followed by the frames,
+ * as they are in memory. The data is written with one pwrite() per append, and the
+ * file is extended in big steps (fallocate) to keep the file system work low.
+ * Each append also adds an entry to the sidecar index.
+ */
+template <typename T> class raw_sink : public data_sink<T> {
+public:
+    /// The file is extended this many bytes at a time
+    static const uint64_t PREALLOC_BYTES=64<<20;
+
+    raw_sink(
+             double sample_rate,    ///< frames per second >.
+             unsigned int channels=1 ///< elements per frame >.
+            ) : sample_rate(sample_rate), n_channels(channels) {}
+
+    unsigned int channels() const override { return n_channels; }
+
+    ~raw_sink() override
+    {
+        if (fd>=0)
+            ::close(fd);
+        if (index_file)
+            fclose(index_file);
+    }
+
+    void open(const std::string& name) override
+    {
+        fname=name+extension();
+        fd=::open(fname.c_str(),O_RDWR|O_CREAT|O_TRUNC,0644);
+        if (fd<0)
+            throw std::runtime_error("raw_sink: can't create "+fname+": "+strerror(errno));
+        index_file=fopen((fname+".idx").c_str(),"w");
+        if (!index_file)
+            throw std::runtime_error("raw_sink: can't create "+fname+".idx: "+strerror(errno));
+
+        memset(&header,0,sizeof(header));
+        memcpy(header.magic,RAW_MAGIC,sizeof(header.magic));
+        header.header_size=sizeof(header);
+        header.elem_size=sizeof(T);
+        strncpy(header.dtype,raw_dtype<T>::name(),sizeof(header.dtype)-1);
+        header.sample_rate=sample_rate;
+        header.channels=n_channels;
+        write_at(&header,sizeof(header),0);
+        appended=0;
+        allocated=0;
+    }
+
+    void append(const T* data,size_t n,uint64_t index) override
+    {
+        if (!appended)
+            header.first_index=index;
+
+        size_t   frame_bytes=n_channels*sizeof(T);
+        uint64_t offset=sizeof(header)+appended*frame_bytes;
+        uint64_t end=offset+n*frame_bytes;
+        if (end>allocated) {
+            allocated=(end+PREALLOC_BYTES-1)/PREALLOC_BYTES*PREALLOC_BYTES;
+            posix_fallocate(fd,0,allocated);   // just an optimisation if it fails
+        }
+        write_at(data,n*frame_bytes,offset);
+        appended+=n;
+
+        raw_index_entry entry;
+        entry.first_index=index;
+        entry.offset=offset;
+        entry.n_frames=n;
+        entry.time_ns=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        if (fwrite(&entry,sizeof(entry),1,index_file)!=1)
+            throw std::runtime_error("raw_sink: can't write "+fname+".idx");
+    }
+
+    uint64_t bytes_stored() const override { return sizeof(header)+appended*n_channels*sizeof(T); }
+
+    void close() override
+    {
+        header.n_frames=appended;
+        write_at(&header,sizeof(header),0);
+        if (ftruncate(fd,bytes_stored())!=0)
+            throw std::runtime_error("raw_sink: can't truncate "+fname+": "+strerror(errno));
+        ::close(fd);
+        fd=-1;
+        if (fclose(index_file)!=0)
+            throw std::runtime_error("raw_sink: can't write "+fname+".idx");
+        index_file=NULL;
+    }
+
+    void discard() override
+    {
+        ::close(fd);
+        fd=-1;
+        fclose(index_file);
+        index_file=NULL;
+        unlink(fname.c_str());
+        unlink((fname+".idx").c_str());
+    }
+
+    std::string file_name() const override { return fname; }
+    const char* extension() const override { return ".rbin"; }
+
+private:
+    void write_at(const void* data,size_t n_bytes,uint64_t offset)
+    {
+        const char *p=static_cast<const char*>(data);
+        while (n_bytes>0) {
+            ssize_t n=pwrite(fd,p,n_bytes,offset);
+            if (n<0) {
+                if (errno==EINTR)
+                    continue;
+                throw std::runtime_error("raw_sink: can't write "+fname+": "+strerror(errno));
+            }
+            p+=n;
+            n_bytes-=n;
+            offset+=n;
+        }
+    }
+
+    double      sample_rate;
+    unsigned int n_channels;
+    std::string fname;
+    int         fd=-1;
+    FILE       *index_file=NULL;
+    raw_header  header;
+    uint64_t    appended=0;      // frames
+    uint64_t    allocated=0;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef __DRAIN_STATS
+#define __DRAIN_STATS
+
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <chrono>
+
+
+/**
+ * Counters of a consumer that drains a ring buffer: each read takes all the points
+ * available, up to a max I/O size. When more points are available than a read can
+ * take, the consumer is behind (e.g. after a stall): it is catching up until a read
+ * takes all of them. The points read while behind, and the time it took, give the
+ * rate at which it catches up.
+ */
+struct drain_stats {
+    uint64_t reads=0;            ///< reads done
+    uint64_t points=0;           ///< points read
+    uint64_t max_batch=0;        ///< most points taken by a read
+    uint64_t max_lag=0;          ///< most points available at a read
+    uint64_t catch_ups=0;        ///< times the consumer fell behind
+    uint64_t catch_up_points=0;  ///< points read while behind
+    uint64_t catch_up_ns=0;      ///< time spent behind
+
+    /// Counts a read of 'n' points, when 'lag' points were available
+    void read(uint64_t n,uint64_t lag)
+    {
+        auto now=std::chrono::steady_clock::now();
+        reads++;
+        points+=n;
+        if (n>max_batch)
+            max_batch=n;
+        if (lag>max_lag)
+            max_lag=lag;
+
+        if (lag>n) {
+            if (!behind) {
+                behind=true;
+                behind_since=now;
+                catch_ups++;
+            }
+            catch_up_points+=n;
+        } else if (behind) {
+            behind=false;
+            catch_up_points+=n;
+            catch_up_ns+=std::chrono::duration_cast<std::chrono::nanoseconds>(now-behind_since).count();
+        }
+    }
+
+    /// Points per second read while behind (0 if never behind)
+    double catch_up_rate() const
+    {
+        return catch_up_ns? catch_up_points*1e9/catch_up_ns : 0;
+    }
+
+    /// "N reads, max batch X, max lag Y points, behind Z times..."
+    std::string summary() const
+    {
+        std::ostringstream out;
+        out << reads << " reads (" << (reads? points/reads : 0) << " points on average, max " << max_batch
+            << "), max lag " << max_lag << " points, behind " << catch_ups << " times";
+        if (catch_ups)
+            out << " (" << catch_up_points << " points caught up at " << catch_up_rate()/1e6 << " Mpoints/s)";
+        return out.str();
+    }
+
+private:
+    bool behind=false;
+    std::chrono::steady_clock::time_point behind_since;
+};
+
+#endif
@@ -1,6 +1,10 @@
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <atomic>
 
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/variables_map.hpp>
@@ -8,7 +12,7 @@
 
 #include "cmn.h"
 
-#include "period_repeat.h"
+#include "period_scheduler.h"
 
 
 using namespace std;
@@ -16,14 +20,25 @@ using namespace boost;
 
 // Generator for the generator/reader example.
 // This generates a continuous sequence of data points and puts them in a ring buffer.
-// To evenly spread the CPU load, the generator wakes up every INTERVAL_MSEC
-// milliseconds and produces the appropriate amount of data points to do POINTS_PER_SEC
-// points every seconds.
-
-
-
+// To evenly spread the CPU load, the generator wakes up every 'interval_msec'
+// milliseconds and produces the appropriate amount of data points to do 'points_per_sec'
+// frames every seconds, written in chunks of at most 'chunk_points' frames.
+// The wake ups are paced by a period_scheduler (on the monotonic clock): if producing
+// takes longer than the interval, the ticks missed are run back to back or skipped
+// (the points due are produced anyway), and at the end the jitter of the wake ups and
+// the overruns are printed.
+// A frame is a point per channel (see CHANNELS_NAME): with C channels, frame 'f'
+// holds the points 'f*C' to 'f*C+C-1' of the sequence.
+// With '--max-rate' it produces the same points as fast as it can (no pacing) and
+// prints the rate achieved, the percentiles of the time taken by each write and
+// the overruns of each reader, to measure the throughput of the ring buffer.
+// The generator itself is run(), on the ring buffers of a segment: main() runs it
+// on the shared memory segment, the launcher on a heap segment (see launcher.cpp).
+
+
+
+/// Default time between two wake ups (msec)
 static const unsigned int INTERVAL_MSEC=20;
-static const unsigned int POINTS_PER_INTERVAL=(POINTS_PER_SEC/1000)*INTERVAL_MSEC;
 
 
 
@@ -31,57 +46,168 @@ static const unsigned int POINTS_PER_INTERVAL=(POINTS_PER_SEC/1000)*INTERVAL_MSE
 //------------- Modified using command line arguments --------
 unsigned int seconds_to_run=600;
 bool quiet=false;
+bool exact=false;       // generate() for each point, instead of generate_batch()
+bool max_rate=false;    // as fast as possible, instead of 'points_per_sec'
+unsigned int points_per_sec=POINTS_PER_SEC;    // frames per second
+unsigned int interval_msec=INTERVAL_MSEC;
+size_t chunk_points=0;  // Max frames per write (0: all those of an interval)
+period_catch_up catch_up=period_catch_up::burst;    // after an overrun
+int fifo_priority=0;    // SCHED_FIFO priority (0: normal scheduling)
+vector<int> cpus;       // cpus to run on (empty: any)
 
 void parse_args(int argc,char *argv[]);
 
+// Set to stop before 'seconds_to_run' (by the launcher)
+static atomic<bool> stop_requested(false);
 
 
-int main(int argc,char *argv[])
+
+/**
+ * Generates the 'n' points from 'k0' in 'out'
+ */
+static void generate_points(size_t k0,size_t n,data_point_t* out)
 {
-    parse_args(argc,argv);
+    if (exact) {
+        for (size_t k=0;k<n;k++)
+            out[k]=generate(k0+k);
+    } else
+        generate_batch(k0,n,out);
+}
 
-    // Setup for the ring buffer, which must have been ALREDAY CREATED (this
-    // just opens it)
-    interprocess::managed_shared_memory segment(interprocess::open_only, SHARED_MEM_NAME);
+
+/**
+ * Prints the percentiles of the durations in 'ns' (sorts them)
+ */
+static void print_percentiles(const char* what,vector<uint64_t>& ns)
+{
+    if (ns.empty())
+        return;
+    sort(ns.begin(),ns.end());
+    cout << what;
+    for (double p : {50.0,90.0,99.0,99.9}) {
+        size_t k=size_t(p/100*(ns.size()-1));
+        cout << " p" << p << " " << ns[k]/1000.0 << " us ";
+    }
+    cout << " max " << ns.back()/1000.0 << " us" << endl;
+}
+
+
+
+/**
+ * Generates the points in RINGBUF_NAME1 of 'segment', as chosen with the command line
+ */
+template <typename SEGMENT>
+int run(SEGMENT& segment)
+{
     shm_ringbuf buf(RINGBUF_NAME1,segment);
+    size_t channels=get_channels(segment);
+
+    try {
+        set_thread_scheduling(fifo_priority,cpus);
+    } catch (std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return -1;
+    }
 
 
     size_t j=0;   // counter for generated points
+    size_t total_points=size_t(seconds_to_run)*points_per_sec*channels;
+
+    // Generate a chunk of data points directly in the ring buffer
+    // (in two parts if it wraps around the buffer bottom) and publish it.
+    // Only whole frames are published, even if the buffer has less room.
+    auto write_chunk = [&](size_t n) {
+        auto region=buf.reserve_write(n);
+        size_t m=region.size()-region.size()%channels;
+        size_t n1=min(m,region.n1);
+        generate_points(j,n1,region.data1);
+        generate_points(j+n1,m-n1,region.data2);
+        j+=m;
+        buf.commit_write(m);
+    };
+    size_t max_chunk=(chunk_points? chunk_points : size_t(points_per_sec)*interval_msec/1000)*channels;
+    if (max_chunk==0)
+        max_chunk=channels;
+
+    if (max_rate) {
+        vector<uint64_t> write_ns;
+        write_ns.reserve(total_points/max_chunk+1);
+        swmr_stats st0=buf.stats();
+
+        auto t0=chrono::steady_clock::now();
+        while (j<total_points && !stop_requested) {
+            auto t=chrono::steady_clock::now();
+            write_chunk(min(max_chunk,total_points-j));
+            write_ns.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-t).count());
+        }
+        double sec=chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+
+        cout << "Generated " << j << " points in " << sec << " s: " << j/sec/1e6 << " Mpoints/s, "
+             << write_ns.size() << " writes of up to " << max_chunk << " points" << endl;
+        print_percentiles("Write time:",write_ns);
+        swmr_stats st=buf.stats();
+        for (size_t k=0;k<st.readers.size();k++) {
+            if (!st.readers[k].active)
+                continue;
+            cout << "Reader " << k << ": " << st.readers[k].overruns-st0.readers[k].overruns << " overruns, "
+                 << st.readers[k].lost-st0.readers[k].lost << " points lost" << endl;
+        }
+        return 0;
+    }
 
-    period_repeat(
-
-        INTERVAL_MSEC, // How frequently to repeat
+    period_scheduler scheduler(chrono::milliseconds(interval_msec),catch_up);
+    size_t next_print=points_per_sec*channels;
+    scheduler.run(
 
         // What to do each time
         [&] {
 
-            // Generate a chunk of data points in memory
-            data_point_t membuf[POINTS_PER_INTERVAL];
-            for (auto &x : membuf)
-                x=generate(j++);
-
-            // Write the chunk to the ring buffer
-            buf.write(membuf,POINTS_PER_INTERVAL);
+            // The points due by the end of this interval (computed from the start,
+            // so a rate that is not a multiple of the intervals doesn't drift, and
+            // the ticks skipped after an overrun are made up for)
+            size_t due=min<size_t>(total_points,scheduler.tick()*uint64_t(points_per_sec)*interval_msec/1000*channels);
+            while (j<due)
+                write_chunk(min(max_chunk,due-j));
 
             // Every second print a message (just for feedback)
-            if (!quiet && (j%POINTS_PER_SEC)==0) {
+            if (!quiet && j>=next_print) {
+                next_print+=points_per_sec*channels;
                 cout << "buffer contains [ ";
-                for (int k=0;k<MAX_READERS;k++)
+                for (size_t k=0;k<buf.max_readers();k++)
                     cout << buf.read_available(k) << " ";
                 cout << "] points" <<  endl;
             }
         },
 
         // Continue while this condition is true
-        [&j] {
-            return j < (seconds_to_run*POINTS_PER_SEC); // j < (Total points to generate) ?
+        [&] {
+            return j < total_points && !stop_requested; // j < (Total points to generate) ?
         }
     );
 
+    if (!quiet) {
+        const period_stats& st=scheduler.stats();
+        cout << "Generator: " << st.ticks << " ticks, " << st.overruns << " overruns (" << st.skipped << " ticks skipped)"
+             << ", wake up late " << st.jitter.summary() << endl;
+        if (st.overruns)
+            cout << "Generator: overruns late " << st.overrun.summary() << endl;
+    }
+
     return 0;
 }
 
 
+int main(int argc,char *argv[])
+{
+    parse_args(argc,argv);
+
+    // Setup for the ring buffer, which must have been ALREDAY CREATED (this
+    // just opens it)
+    interprocess::managed_shared_memory segment(interprocess::open_only, SHARED_MEM_NAME);
+    return run(segment);
+}
+
+
 
 
 /**
@@ -99,6 +225,14 @@ void parse_args(int argc,char *argv[])
         ("help", "write this help message")
         ("quiet", "don't print any message")
         ("seconds", po::value<unsigned int>(), "how many seconds to run")
+        ("exact", "compute each point with generate() (default: generate_batch(), within GENERATE_BATCH_TOLERANCE)")
+        ("rate", po::value<unsigned int>(), "frames (data points per channel) per second (default: POINTS_PER_SEC)")
+        ("interval", po::value<unsigned int>(), "time between two wake ups (msec, default: 20)")
+        ("chunk", po::value<size_t>(), "max frames per write (default: all those of an interval)")
+        ("max-rate", "generate the points as fast as possible, and print the rate, the percentiles of the write time and the overruns of the readers")
+        ("catch-up", po::value<string>(), "after a tick that took longer than the interval: 'burst' (default, run the ticks missed back to back) or 'skip' (skip them)")
+        ("fifo", po::value<int>(), "run with this SCHED_FIFO real-time priority (1..99)")
+        ("cpus", po::value<string>(), "run on these cpus (e.g. 0,2)")
     ;
 
     po::variables_map vm;
@@ -115,4 +249,51 @@ void parse_args(int argc,char *argv[])
 
     if (vm.count("seconds"))
         seconds_to_run= vm["seconds"].as<unsigned int>();
+
+    if (vm.count("exact"))
+        exact=true;
+
+    if (vm.count("max-rate"))
+        max_rate=true;
+
+    if (vm.count("rate"))
+        points_per_sec= vm["rate"].as<unsigned int>();
+
+    if (vm.count("interval"))
+        interval_msec= vm["interval"].as<unsigned int>();
+
+    if (vm.count("chunk"))
+        chunk_points= vm["chunk"].as<size_t>();
+
+    if (points_per_sec==0 || interval_msec==0) {
+        cerr << "ERROR: rate and interval must be > 0" << endl;
+        exit(-1);
+    }
+
+    if (vm.count("catch-up")) {
+        string policy= vm["catch-up"].as<string>();
+        if (policy=="skip")
+            catch_up= period_catch_up::skip;
+        else if (policy!="burst") {
+            cerr << "ERROR: unknown catch-up policy " << policy << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("fifo")) {
+        fifo_priority= vm["fifo"].as<int>();
+        if (fifo_priority<1 || fifo_priority>99) {
+            cerr << "ERROR: the SCHED_FIFO priority must be 1..99" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("cpus")) {
+        try {
+            cpus= parse_cpu_list(vm["cpus"].as<string>());
+        } catch (std::exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            exit(-1);
+        }
+    }
 }
\ No newline at end of file
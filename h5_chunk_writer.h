@@ -0,0 +1,202 @@
+#ifndef __H5_CHUNK_WRITER
+#define __H5_CHUNK_WRITER
+
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <future>
+#include <memory>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "H5Cpp.h"
+
+#include "worker_pool.h"
+
+
+/**
+ * The filters applied to each chunk of an HDF5 dataset (in this order).
+ * They are the standard HDF5 filters, so the files can be read by any HDF5 tool.
+ */
+struct h5_filters {
+    bool shuffle=false;   ///< byte shuffle (groups the bytes of the same significance)
+    int  deflate=0;       ///< deflate (zlib) compression level 1..9, 0 for no compression
+
+    bool any() const { return shuffle || deflate>0; }
+};
+
+
+/**
+ * Writes a chunked dataset of elements of type T one chunk at a time with
+ * H5Dwrite_chunk(), applying the filters to the chunks on a pool of worker
+ * threads. Only the calling thread uses the HDF5 library (which is serialised by
+ * its global lock), and only to write chunks already filtered.
+ *
+ * The data is appended with append_begin()/append_end(): the caller copies the data
+ * directly where it is collected. Complete chunks are handed to the workers and
+ * written in order as soon as they are ready. finish() writes the last (partial)
+ * chunk and waits for all of them to be written.
+ *
+ * The dataset is 1-D, or 2-D with rows of 'row_size' elements (e.g. [samples x
+ * channels]): the data is appended and chunked by whole rows.
+ *
+ * If the dataset is extensible, it is extended (H5Dset_extent) as the chunks are
+ * written, so at the end its size is the number of rows appended.
+ */
+template <typename T> class h5_chunk_writer {
+public:
+    h5_chunk_writer(
+                    size_t chunk_rows,         ///< rows per chunk (elements for a 1-D dataset) >.
+                    const h5_filters& filters, ///< filters to apply >.
+                    worker_pool& pool,         ///< the threads that apply the filters >.
+                    size_t row_size=1          ///< elements per row: >1 for a 2-D dataset >.
+                   ) : chunk_rows(chunk_rows), row_size(row_size), filters(filters), pool(pool)
+    {
+        if (chunk_rows==0 || row_size==0)
+            throw std::invalid_argument("h5_chunk_writer: chunk and row size must be > 0");
+    }
+
+    /// Sets up the properties for creating a dataset written by this object
+    void set_create_props(H5::DSetCreatPropList& plist) const
+    {
+        hsize_t chunk_dim[2]={chunk_rows,row_size};
+        plist.setChunk(row_size>1? 2 : 1,chunk_dim);
+        if (filters.shuffle)
+            plist.setShuffle();
+        if (filters.deflate>0)
+            plist.setDeflate(filters.deflate);
+    }
+
+    /// Starts writing a new dataset (created with set_create_props()), from its start
+    void start(const H5::DataSet& dataset)
+    {
+        dset_id=dataset.getId();
+        hsize_t dims[2];
+        dataset.getSpace().getSimpleExtentDims(dims);
+        extent=dims[0];
+        next_chunk=0;
+        pending.clear();
+    }
+
+    /// Returns where to put the next 'n' rows
+    T* append_begin(size_t n)
+    {
+        appended=pending.size();
+        pending.resize(appended+n*row_size);
+        return pending.data()+appended;
+    }
+
+    /// Appends the 'n' rows put where returned by append_begin(), except the
+    /// first 'n_skip' of them
+    void append_end(size_t n,size_t n_skip=0)
+    {
+        pending.resize(appended+n*row_size);
+        if (n_skip)
+            pending.erase(pending.begin()+appended,pending.begin()+appended+n_skip*row_size);
+
+        size_t chunk_elems=chunk_rows*row_size;
+        size_t n_full=pending.size()/chunk_elems*chunk_elems;
+        for (size_t k=0;k<n_full;k+=chunk_elems)
+            submit(pending.data()+k,chunk_rows);
+        pending.erase(pending.begin(),pending.begin()+n_full);
+    }
+
+    /// Writes the last chunk (padded) and all the chunks not written yet
+    void finish()
+    {
+        if (!pending.empty())
+            submit(pending.data(),pending.size()/row_size);
+        pending.clear();
+        while (!in_flight.empty())
+            write_first();
+    }
+
+    /// Bytes of chunks written in the file since creation
+    uint64_t bytes_written() const { return total_bytes; }
+
+private:
+    struct chunk_task {
+        hsize_t offset;   // first row
+        size_t  n;        // rows of the chunk (the rest is padding)
+        std::future<std::vector<unsigned char>> data;
+    };
+
+    // Hands a chunk to the workers, and writes the ones ready (waiting if too
+    // many are in flight)
+    void submit(const T* data,size_t n)
+    {
+        auto raw=std::make_shared<std::vector<T>>(chunk_rows*row_size,T());
+        memcpy(raw->data(),data,n*row_size*sizeof(T));
+
+        auto task=std::make_shared<std::packaged_task<std::vector<unsigned char>()>>(
+                      [raw,this] { return apply_filters(*raw); });
+        in_flight.push_back(chunk_task{next_chunk*chunk_rows,n,task->get_future()});
+        next_chunk++;
+        pool.submit([task] { (*task)(); });
+
+        size_t max_in_flight=2*pool.size()+1;
+        while (!in_flight.empty() &&
+               (in_flight.size()>max_in_flight ||
+                in_flight.front().data.wait_for(std::chrono::seconds(0))==std::future_status::ready))
+            write_first();
+    }
+
+    void write_first()
+    {
+        std::vector<unsigned char> chunk=in_flight.front().data.get();
+        hsize_t offset[2]={in_flight.front().offset,0};
+        hsize_t end=offset[0]+in_flight.front().n;
+        in_flight.pop_front();
+        if (end>extent) {
+            hsize_t dims[2]={end,row_size};
+            if (H5Dset_extent(dset_id,dims)<0)
+                throw std::runtime_error("h5_chunk_writer: H5Dset_extent fails");
+            extent=end;
+        }
+        if (H5Dwrite_chunk(dset_id,H5P_DEFAULT,0,offset,chunk.size(),chunk.data())<0)
+            throw std::runtime_error("h5_chunk_writer: H5Dwrite_chunk fails");
+        total_bytes+=chunk.size();
+    }
+
+    // The same transformation as the HDF5 filters: shuffle, then deflate (zlib format)
+    std::vector<unsigned char> apply_filters(const std::vector<T>& raw) const
+    {
+        size_t n_bytes=raw.size()*sizeof(T);
+        const unsigned char *bytes=reinterpret_cast<const unsigned char*>(raw.data());
+
+        std::vector<unsigned char> shuffled;
+        if (filters.shuffle) {
+            shuffled.resize(n_bytes);
+            for (size_t b=0;b<sizeof(T);b++)
+                for (size_t k=0;k<raw.size();k++)
+                    shuffled[b*raw.size()+k]=bytes[k*sizeof(T)+b];
+            bytes=shuffled.data();
+        }
+
+        if (filters.deflate==0)
+            return std::vector<unsigned char>(bytes,bytes+n_bytes);
+
+        uLongf out_size=compressBound(n_bytes);
+        std::vector<unsigned char> out(out_size);
+        if (compress2(out.data(),&out_size,bytes,n_bytes,filters.deflate)!=Z_OK)
+            throw std::runtime_error("h5_chunk_writer: deflate fails");
+        out.resize(out_size);
+        return out;
+    }
+
+    size_t       chunk_rows;
+    size_t       row_size;
+    h5_filters   filters;
+    worker_pool& pool;
+
+    hid_t          dset_id=-1;
+    hsize_t        extent=0;         // current rows of the dataset
+    hsize_t        next_chunk=0;     // index of the next chunk of the dataset
+    std::vector<T> pending;          // data not yet handed out in a chunk
+    size_t         appended=0;
+    std::deque<chunk_task> in_flight;
+    uint64_t       total_bytes=0;
+};
+
+#endif
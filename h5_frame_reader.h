@@ -0,0 +1,110 @@
+#ifndef __H5_FRAME_READER
+#define __H5_FRAME_READER
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "H5Cpp.h"
+
+
+/**
+ * Reads the frames of a file written by h5_sink, whatever the layout of its
+ * channels: a 1-D dataset (one channel), a 2-D dataset [frames x channels] or one
+ * 1-D dataset per channel ('name_0', 'name_1'...). The frames are read interleaved,
+ * as they are in the ring buffers.
+ *
+ * For a file written in SWMR mode, refresh() gets the frames written since the
+ * last time.
+ */
+class h5_frame_reader {
+public:
+    h5_frame_reader(
+                    H5::H5File& file,        ///< the file, already open >.
+                    const std::string& name  ///< name of the dataset (or prefix of the per-channel datasets) >.
+                   )
+    {
+        if (H5Lexists(file.getId(),name.c_str(),H5P_DEFAULT)>0) {
+            datasets.push_back(file.openDataSet(name));
+            hsize_t dims[2]={0,1};
+            H5::DataSpace space=datasets[0].getSpace();
+            if (space.getSimpleExtentNdims()>2)
+                throw std::runtime_error("h5_frame_reader: "+name+" has more than 2 dimensions");
+            space.getSimpleExtentDims(dims);
+            n_channels=(space.getSimpleExtentNdims()==2)? dims[1] : 1;
+        } else {
+            for (unsigned int c=0;;c++) {
+                std::string dname=name+"_"+std::to_string(c);
+                if (H5Lexists(file.getId(),dname.c_str(),H5P_DEFAULT)<=0)
+                    break;
+                datasets.push_back(file.openDataSet(dname));
+            }
+            if (datasets.empty())
+                throw std::runtime_error("h5_frame_reader: no dataset "+name);
+            n_channels=datasets.size();
+            per_channel=true;
+        }
+        if (datasets[0].attrExists("first_index"))
+            datasets[0].openAttribute("first_index").read(H5::PredType::NATIVE_UINT64,&first);
+    }
+
+    unsigned int channels() const { return n_channels; }
+
+    /// Index in the stream of the first frame
+    uint64_t first_index() const { return first; }
+
+    /// Frames in the file (of all the channels)
+    hsize_t frames() const
+    {
+        hsize_t n=0;
+        for (size_t k=0;k<datasets.size();k++) {
+            hsize_t dims[2];
+            datasets[k].getSpace().getSimpleExtentDims(dims);
+            if (k==0 || dims[0]<n)
+                n=dims[0];
+        }
+        return n;
+    }
+
+    /// Reads the changes of the datasets written in SWMR mode. Returns false on error
+    bool refresh()
+    {
+        for (auto &d : datasets) {
+            if (H5Drefresh(d.getId())<0)
+                return false;
+        }
+        return true;
+    }
+
+    /// Reads 'n' frames from frame 'f0' in 'out' ('n' x channels() points)
+    void read(hsize_t f0,hsize_t n,double* out)
+    {
+        if (!per_channel) {
+            H5::DataSpace space=datasets[0].getSpace();
+            hsize_t offset[2]={f0,0};
+            hsize_t count[2]={n,n_channels};
+            H5::DataSpace memspace(space.getSimpleExtentNdims(),count);
+            space.selectHyperslab(H5S_SELECT_SET,count,offset);
+            datasets[0].read(out,H5::PredType::NATIVE_DOUBLE,memspace,space);
+            return;
+        }
+        column.resize(n);
+        for (unsigned int c=0;c<n_channels;c++) {
+            H5::DataSpace space=datasets[c].getSpace();
+            H5::DataSpace memspace(1,&n);
+            space.selectHyperslab(H5S_SELECT_SET,&n,&f0);
+            datasets[c].read(column.data(),H5::PredType::NATIVE_DOUBLE,memspace,space);
+            for (hsize_t f=0;f<n;f++)
+                out[f*n_channels+c]=column[f];
+        }
+    }
+
+private:
+    std::vector<H5::DataSet> datasets;
+    unsigned int        n_channels=1;
+    bool                per_channel=false;
+    uint64_t            first=0;
+    std::vector<double> column;
+};
+
+#endif
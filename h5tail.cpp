@@ -0,0 +1,210 @@
+#include <unistd.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/parsers.hpp>
+
+#include "H5Cpp.h"
+
+#include "cmn.h"
+#include "h5_frame_reader.h"
+
+using namespace std;
+using namespace boost;
+using namespace H5;
+
+// Follows an HDF5 file while the reader writes it in SWMR mode ('reader --swmr'),
+// like 'tail -f': the file is opened with H5F_ACC_SWMR_READ and every interval the
+// dataset is refreshed and the new data points are read. Prints how many points
+// were added and the last one. With '--verify' the points are checked against
+// 'generate()' (and 'transform()') as verify_results does (with the same tolerance), starting from the
+// 'first_index' attribute of the dataset.
+// The files with more than one channel are followed frame by frame (see
+// h5_frame_reader.h), verifying the interleaved sequence.
+// Stops when the file has not grown for '--idle' seconds (the reader has moved on
+// to the next file or has stopped).
+
+
+
+//------------- Modified using command line arguments --------
+string file_name;
+double interval_sec=1;
+double idle_sec=5;
+bool verify=false;
+bool do_transform=false;
+double tolerance=GENERATE_BATCH_TOLERANCE;
+bool quiet=false;
+
+void parse_args(int argc,char *argv[]);
+
+
+
+int main(int argc,char *argv[])
+{
+    parse_args(argc,argv);
+    Exception::dontPrint();
+
+    // The file can be opened only after the reader has started the SWMR mode
+    // (when it writes the first data): retry until then
+    unique_ptr<H5File> file;
+    unique_ptr<h5_frame_reader> frames;
+    auto t0=chrono::steady_clock::now();
+    while (true) {
+        try {
+            file.reset(new H5File(H5std_string(file_name), H5F_ACC_RDONLY | H5F_ACC_SWMR_READ));
+            frames.reset(new h5_frame_reader(*file,DATASET_NAME));
+            break;
+        } catch (H5::Exception &e) {
+            file.reset();
+            if (chrono::steady_clock::now()-t0>chrono::duration<double>(idle_sec)) {
+                cerr << "ERROR: can't open " << file_name << " for SWMR read" << endl;
+                return -1;
+            }
+            this_thread::sleep_for(chrono::milliseconds(100));
+        } catch (std::exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            return -1;
+        }
+    }
+
+    size_t channels=frames->channels();
+    uint64_t first_index=frames->first_index()*channels;
+
+    const size_t MEMBUF_SIZE=65536;
+    size_t max_frames=max<size_t>(MEMBUF_SIZE/channels,1);
+    vector<data_point_t> membuf(max_frames*channels);
+    hsize_t n_read=0;       // frames
+    size_t mismatch_count=0;
+    auto last_growth=chrono::steady_clock::now();
+
+    while (true) {
+        this_thread::sleep_for(chrono::duration<double>(interval_sec));
+
+        // See the data flushed by the writer since the last time
+        if (!frames->refresh()) {
+            cerr << "ERROR: can't refresh the dataset" << endl;
+            return -1;
+        }
+        hsize_t n_frames=frames->frames();
+
+        auto now=chrono::steady_clock::now();
+        if (n_frames==n_read) {
+            if (now-last_growth>chrono::duration<double>(idle_sec))
+                break;
+            continue;
+        }
+        last_growth=now;
+
+        hsize_t n_new=n_frames-n_read;
+        data_point_t last=0;
+        while (n_read<n_frames) {
+            hsize_t nf=min<hsize_t>(n_frames-n_read,max_frames);
+            size_t  n=nf*channels;
+            frames->read(n_read,nf,membuf.data());
+
+            if (verify) {
+                for (size_t k=0;k<n;k++) {
+                    size_t j=first_index+n_read*channels+k;
+                    data_point_t x_ref = generate(j);
+                    if (do_transform)
+                        x_ref = transform(j,x_ref);
+                    if (!(fabs(membuf[k]-x_ref)<=tolerance) && mismatch_count++<30)
+                        cerr << "ERROR: mismatch at data point " << j << ": " << membuf[k] << " instead of " << x_ref << endl;
+                }
+            }
+            last=membuf[n-1];
+            n_read+=nf;
+        }
+
+        if (!quiet)
+            cout << file_name << ": " << n_frames << " frames (+" << n_new << "), last "
+                 << setprecision(6) << last << endl;
+    }
+
+    if (verify) {
+        if (mismatch_count==0)
+            cout << "Verification successful (" << n_read*channels << " data points)" << endl;
+        else
+            cout << "ERROR: " << mismatch_count << " mismatches found" << endl;
+    }
+    return mismatch_count? -1 : 0;
+}
+
+
+
+/**
+ * Parsing command line arguments, using BOOST.
+ * See BOOST documentation for details.
+ */
+void parse_args(int argc,char *argv[])
+{
+    namespace po = boost::program_options;
+
+    // Declare the supported options.
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+        ("help", "write this help message")
+        ("quiet", "don't print the progress")
+        ("interval", po::value<double>(), "seconds between two reads (default: 1)")
+        ("idle", po::value<double>(), "stop when the file has not grown for this many seconds (default: 5)")
+        ("verify", "verify the data points")
+        ("transform", "verify the data points of the transformer")
+        ("tolerance", po::value<double>(), "max difference from the reference when verifying (default: GENERATE_BATCH_TOLERANCE)")
+        ("exact", "the points must be equal to the reference (generator run with --exact)")
+        ("file", po::value<string>(), "HDF5 file to follow")
+    ;
+    po::positional_options_description file;
+    file.add("file",1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc,argv).options(desc).positional(file).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << "h5tail [options] file.h5" << endl << desc << "\n";
+        exit(0);
+    }
+
+    if (vm.count("quiet"))
+        quiet=true;
+
+    if (vm.count("interval")) {
+        interval_sec= vm["interval"].as<double>();
+        if (interval_sec<=0) {
+            cerr << "ERROR: interval must be > 0" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("idle"))
+        idle_sec= vm["idle"].as<double>();
+
+    if (vm.count("verify"))
+        verify=true;
+
+    if (vm.count("transform")) {
+        verify=true;
+        do_transform=true;
+    }
+
+    if (vm.count("tolerance"))
+        tolerance= vm["tolerance"].as<double>();
+
+    if (vm.count("exact"))
+        tolerance= 0;
+
+    if (vm.count("file"))
+        file_name= vm["file"].as<string>();
+    if (file_name.empty()) {
+        cerr << "ERROR: need the name of the file" << endl;
+        exit(-1);
+    }
+}
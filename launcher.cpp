@@ -0,0 +1,354 @@
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/interprocess/managed_heap_memory.hpp>
+
+#include "H5Cpp.h"
+
+#include "cmn.h"
+#include "period_scheduler.h"
+#include "transform_stages.h"
+#include "worker_pool.h"
+#include "data_sink.h"
+#include "buffer_queue.h"
+#include "drain_stats.h"
+
+// Runs the generator, the transformer and the readers as threads of this process,
+// instead of as processes of their own: the ring buffers are in a heap segment
+// (boost::interprocess::managed_heap_memory, see swmr_ringbuffer.h) created here,
+// instead of the shared memory segment created by setup, and they are destroyed
+// with it at the end. There are no named mutexes, no shared memory and no startup
+// delays, and the whole pipeline can be profiled with one 'perf record'.
+//
+// Each stage is the run() of its program, with the same options as its command
+// line (given as one string, e.g. --reader "--tag rA --buf RING_BUFFER1 --seconds 10"):
+// the program is included below in a namespace of its own, so every stage has its
+// own options. The readers are two instances of reader.cpp, one per ring buffer
+// as in test/test3.sh.
+// Each stage runs in a thread pinned to a cpu (the threads it starts, e.g. the
+// I/O thread of a reader, inherit the cpu). The launcher returns when all the stages
+// have finished; SIGINT or SIGTERM stops them all (the readers close their files),
+// and SIGUSR1 makes the readers start new files.
+
+
+// The programs of the stages. All the headers they include are included above, so
+// here only their own code is, in the namespace.
+namespace generator_stage {
+#include "generator.cpp"
+}
+namespace transformer_stage {
+#include "transformer.cpp"
+}
+namespace reader_stage_0 {
+#include "reader.cpp"
+}
+namespace reader_stage_1 {
+#include "reader.cpp"
+}
+
+
+using namespace std;
+using namespace boost;
+
+
+/// Room for the names and the allocation headers of the objects in the heap segment
+static const unsigned int HEAP_OVERHEAD=4096;
+
+
+/**
+ * A stage of the pipeline: the functions of its program, and its command line
+ */
+struct stage {
+    string name;
+    string args;
+    std::function<void(int,char**)> parse_args;
+    std::function<int(interprocess::managed_heap_memory&)> run;
+    atomic<bool> *stop_requested;
+    atomic<bool> *rotate_requested;   // NULL if not a reader
+};
+
+
+//------------- Modified using command line arguments --------
+string generator_args;
+string transformer_args;
+bool with_transformer=false;
+vector<string> reader_args;
+uint64_t buf_size=BUF_SIZE;
+unsigned int max_readers=MAX_READERS;
+unsigned int channels=1;
+vector<int> cpus;       // The cpus to pin the stages to, in turn
+bool pin=true;
+bool quiet=false;
+
+void parse_args(int argc,char *argv[]);
+
+
+/**
+ * Gives the options in 'args' (split at the blanks) to the stage, as its command line
+ */
+static void parse_stage_args(stage& s)
+{
+    vector<string> words;
+    istringstream in(s.args);
+    string word;
+    while (in >> word)
+        words.push_back(word);
+
+    vector<char*> argv;
+    argv.push_back(const_cast<char*>(s.name.c_str()));
+    for (auto &w : words)
+        argv.push_back(const_cast<char*>(w.c_str()));
+    argv.push_back(NULL);
+    s.parse_args(argv.size()-1,argv.data());
+}
+
+
+/**
+ * Pins the calling thread to 'cpu'
+ */
+static void pin_to_cpu(const string& name,int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu,&set);
+    int err=pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+    if (err!=0)
+        cerr << "WARNING: can't pin the " << name << " to cpu " << cpu << ": " << strerror(err) << endl;
+    else if (!quiet)
+        cout << "Launcher: " << name << " on cpu " << cpu << endl;
+}
+
+
+
+int main(int argc,char *argv[])
+{
+    parse_args(argc,argv);
+
+    // The stages, in the order they are started: the consumers first, so they are
+    // attached when the data starts
+    vector<stage> stages;
+    for (size_t k=0;k<reader_args.size();k++) {
+        if (k==0)
+            stages.push_back(stage{"reader 0",reader_args[k],reader_stage_0::parse_args,
+                                   reader_stage_0::run<interprocess::managed_heap_memory>,
+                                   &reader_stage_0::stop_requested,&reader_stage_0::rotate_requested});
+        else
+            stages.push_back(stage{"reader 1",reader_args[k],reader_stage_1::parse_args,
+                                   reader_stage_1::run<interprocess::managed_heap_memory>,
+                                   &reader_stage_1::stop_requested,&reader_stage_1::rotate_requested});
+    }
+    if (with_transformer)
+        stages.push_back(stage{"transformer",transformer_args,transformer_stage::parse_args,
+                               transformer_stage::run<interprocess::managed_heap_memory>,
+                               &transformer_stage::stop_requested,NULL});
+    stages.push_back(stage{"generator",generator_args,generator_stage::parse_args,
+                           generator_stage::run<interprocess::managed_heap_memory>,
+                           &generator_stage::stop_requested,NULL});
+
+    // The options of all the stages are checked before starting any
+    for (auto &s : stages)
+        parse_stage_args(s);
+
+    // The cpus available, if not chosen
+    if (pin && cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0,sizeof(set),&set)==0) {
+            for (int c=0;c<CPU_SETSIZE;c++)
+                if (CPU_ISSET(c,&set))
+                    cpus.push_back(c);
+        }
+        if (cpus.empty())
+            pin=false;
+    }
+
+    // The ring buffers, in a heap segment (the sizes are rounded to whole frames)
+    const char *buf_names[]={RINGBUF_NAME1,RINGBUF_NAME2};
+    uint64_t frames_size=buf_size/channels*channels;
+    size_t n_bytes=HEAP_OVERHEAD;
+    for (size_t k=0;k<2;k++)
+        n_bytes += shm_ringbuf::get_shm_size(frames_size,max_readers);
+    interprocess::managed_heap_memory heap(n_bytes);
+    heap.construct<uint32_t>(CHANNELS_NAME)(channels);
+    try {
+        for (auto name : buf_names)
+            shm_ringbuf::construct(name,heap,frames_size,max_readers);
+    } catch (std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return -1;
+    }
+
+    // The signals are blocked in all the threads (which inherit the mask) and
+    // received by a thread of their own, as in the reader
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals,SIGUSR1);
+    sigaddset(&signals,SIGINT);
+    sigaddset(&signals,SIGTERM);
+    pthread_sigmask(SIG_BLOCK,&signals,NULL);
+
+    auto stop_all=[&] {
+        for (auto &s : stages)
+            *s.stop_requested=true;
+    };
+
+    atomic<bool> done(false);
+    thread signal_thread([&] {
+        timespec timeout={0,100000000};
+        while (!done) {
+            int sig=sigtimedwait(&signals,NULL,&timeout);
+            if (sig==SIGUSR1) {
+                for (auto &s : stages)
+                    if (s.rotate_requested)
+                        *s.rotate_requested=true;
+            } else if (sig>0)
+                stop_all();
+        }
+    });
+
+    // A thread per stage. If a stage fails, the others are stopped (they could
+    // wait for its data forever)
+    auto t0=chrono::steady_clock::now();
+    atomic<bool> failed(false);
+    vector<thread> threads;
+    for (size_t k=0;k<stages.size();k++) {
+        stage &s=stages[k];
+        int cpu= pin? cpus[k%cpus.size()] : -1;
+        threads.emplace_back([&s,&heap,&failed,&stop_all,cpu] {
+            if (cpu>=0)
+                pin_to_cpu(s.name,cpu);
+            int status=-1;
+            try {
+                status=s.run(heap);
+            } catch (std::exception &e) {
+                cerr << "ERROR: " << s.name << ": " << e.what() << endl;
+            } catch (H5::Exception &e) {
+                cerr << "ERROR: " << s.name << ": " << e.getDetailMsg() << endl;
+            }
+            if (status!=0) {
+                failed=true;
+                stop_all();
+            }
+        });
+    }
+
+    for (auto &t : threads)
+        t.join();
+    done=true;
+    signal_thread.join();
+
+    for (auto name : buf_names)
+        shm_ringbuf::remove(name,heap);
+
+    if (!quiet)
+        cout << "Launcher: " << stages.size() << " stages done in "
+             << chrono::duration<double>(chrono::steady_clock::now()-t0).count() << " s" << endl;
+
+    return failed? -1 : 0;
+}
+
+
+
+/**
+ * Parsing command line arguments, using BOOST.
+ * See BOOST documentation for details.
+ */
+void parse_args(int argc,char *argv[])
+{
+    namespace po = boost::program_options;
+
+    // Declare the supported options.
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+        ("help", "write this help message")
+        ("quiet", "don't print any message (of the launcher: the stages have their --quiet)")
+        ("generator", po::value<string>(), "options of the generator (writes RING_BUFFER1), as one string")
+        ("transformer", po::value<string>(), "options of the transformer, as one string (default: no transformer)")
+        ("reader", po::value<vector<string>>(), "options of a reader, as one string (up to 2 readers: repeat the option)")
+        ("buf-size", po::value<uint64_t>(), "size of the two ring buffers (data points, rounded down to whole frames; default: BUF_SIZE)")
+        ("max-readers", po::value<unsigned int>(), "max number of readers of each ring buffer (default: MAX_READERS)")
+        ("channels", po::value<unsigned int>(), "data points per frame (default: 1)")
+        ("cpus", po::value<string>(), "cpus to pin the stages to, in turn (readers, transformer, generator), e.g. 0,2,4 (default: the cpus available)")
+        ("no-pin", "don't pin the stages to cpus")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << desc << "\n";
+        exit(0);
+    }
+
+    if (vm.count("quiet"))
+        quiet=true;
+
+    if (vm.count("generator"))
+        generator_args= vm["generator"].as<string>();
+
+    if (vm.count("transformer")) {
+        transformer_args= vm["transformer"].as<string>();
+        with_transformer= true;
+    }
+
+    if (vm.count("reader")) {
+        reader_args= vm["reader"].as<vector<string>>();
+        if (reader_args.size()>2) {
+            cerr << "ERROR: at most 2 readers" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("buf-size"))
+        buf_size= vm["buf-size"].as<uint64_t>();
+
+    if (vm.count("max-readers"))
+        max_readers= vm["max-readers"].as<unsigned int>();
+
+    if (vm.count("channels")) {
+        channels= vm["channels"].as<unsigned int>();
+        if (channels==0) {
+            cerr << "ERROR: need at least 1 channel" << endl;
+            exit(-1);
+        }
+    }
+
+    if (buf_size/channels==0) {
+        cerr << "ERROR: the buffers must hold at least one frame" << endl;
+        exit(-1);
+    }
+
+    if (vm.count("cpus")) {
+        try {
+            cpus= parse_cpu_list(vm["cpus"].as<string>());
+        } catch (std::exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("no-pin"))
+        pin= false;
+}
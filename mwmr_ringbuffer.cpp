@@ -0,0 +1,447 @@
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <typeinfo>
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+#include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+
+/*
+ * Reserve, wait for the slots to be free, copy, commit and publish.
+ * As for swmr_ringbuffer, the reservation is the announcement of what is going
+ * to be overwritten: the fence keeps the copy after it.
+ * The slots of the reservation are free when the elements of the previous lap
+ * have been committed: a writer that is more than a buffer behind would
+ * otherwise overwrite our data with its own. We do not wait forever for a writer
+ * that could have died.
+ */
+template <typename T>
+size_t mwmr_ringbuffer<T>::write(const T* data_in,size_t n)
+{
+    const unsigned long LAP_WAIT_MSEC=100;
+
+    if (n>buf_size)
+        n=buf_size;
+    if (n==0)
+        return 0;
+
+    uint64_t start=buf->reserve_seq.fetch_add(n,std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (start+n>buf_size) {
+        auto give_up=std::chrono::steady_clock::now()+std::chrono::milliseconds(LAP_WAIT_MSEC);
+        for (uint64_t k=(start>buf_size)? start : buf_size;k<start+n;k++) {
+            while (committed[k%buf_size].load(std::memory_order_acquire) < k-buf_size+1) {
+                if (std::chrono::steady_clock::now()>give_up)
+                    break;
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Copy the data in the buffer, in one or two moves, as required
+    size_t index=start % buf_size;
+    size_t n1=buf_size-index;
+    if (n1>n)
+        n1=n;
+    memcpy(data+index,data_in,n1*sizeof(T));
+    if (n>n1)
+        memcpy(data,data_in+n1,(n-n1)*sizeof(T));
+
+    // Commit: the release fence orders the copy before the flags
+    std::atomic_thread_fence(std::memory_order_release);
+    for (uint64_t k=start;k<start+n;k++)
+        committed[k%buf_size].store(k+1,std::memory_order_relaxed);
+
+    // Ordered with the loads in publish(): if another writer is publishing at the
+    // same time, either it sees our flags or we see its ones
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    publish();
+
+    return n;
+}
+
+/*
+ * Any writer can move the published sequence number forward, over the elements
+ * committed by any writer. An element whose slot has been committed again by a
+ * later lap is lost anyway (the readers skip it), so it does not stop the
+ * publication.
+ */
+template <typename T>
+void mwmr_ringbuffer<T>::publish()
+{
+    uint64_t published=buf->publish_seq.load(std::memory_order_seq_cst);
+    while (true) {
+        uint64_t reserved=buf->reserve_seq.load(std::memory_order_acquire);
+        uint64_t end=published;
+        while (end<reserved && committed[end%buf_size].load(std::memory_order_acquire)>=end+1)
+            end++;
+        if (end==published)
+            break;
+        if (!buf->publish_seq.compare_exchange_strong(published,end,std::memory_order_seq_cst))
+            continue;   // Another writer has published meanwhile: 'published' is updated
+        published=end;
+
+        // Wake up the readers that are waiting for data, as swmr_ringbuffer::commit_write()
+        for (size_t w=0;w<active_words;w++) {
+            uint64_t bits=active[w].load(std::memory_order_seq_cst);
+            while (bits) {
+                auto &rd=readers[w*64+__builtin_ctzll(bits)];
+                uint64_t wake_seq=rd.wake_seq.load(std::memory_order_seq_cst);
+                if (wake_seq!=0 && published>=wake_seq &&
+                    rd.wake_seq.compare_exchange_strong(wake_seq,0,std::memory_order_seq_cst))
+                    rd.wake_sem.post();
+                bits &= bits-1;
+            }
+        }
+    }
+}
+
+/*
+ * As the lock-free swmr_ringbuffer::read(), with the reservation sequence number
+ * in place of the write claim
+ */
+template <typename T>
+size_t mwmr_ringbuffer<T>::read(size_t reader,T* read_buf,size_t n)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in mwmr_ringbuffer::read");
+
+    auto &rd=readers[reader]; // Just for shorthand
+    uint64_t read_seq=rd.seq.load(std::memory_order_relaxed);
+    size_t   n_read;
+
+    while (true) {
+        uint64_t published=buf->publish_seq.load(std::memory_order_acquire);
+        read_seq=skip_lost(read_seq,buf->reserve_seq.load(std::memory_order_relaxed));
+
+        n_read=(published>read_seq)? published-read_seq : 0;
+        if (n_read>n)
+            n_read=n;
+
+        size_t index=read_seq % buf_size;
+        size_t n1=buf_size-index;
+        if (n1>n_read)
+            n1=n_read;
+        memcpy(read_buf,data+index,n1*sizeof(T));
+        if (n_read>n1)
+            memcpy(read_buf+n1,data,(n_read-n1)*sizeof(T));
+
+        // Retry if what we copied has been reserved to be overwritten meanwhile
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t reserved=buf->reserve_seq.load(std::memory_order_relaxed);
+        if (reserved <= read_seq+buf_size)
+            break;
+        read_seq=reserved-buf_size;
+    }
+
+    rd.seq.store(read_seq+n_read,std::memory_order_release);
+    return n_read;
+}
+
+/*
+ * As swmr_ringbuffer::wait_available()
+ */
+template <typename T>
+size_t mwmr_ringbuffer<T>::wait_available(size_t reader,size_t min_n,unsigned long timeout_msec)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in mwmr_ringbuffer::wait_available");
+
+    if (min_n>buf_size)
+        min_n=buf_size;
+
+    size_t available=read_available(reader);
+    if (available>=min_n)
+        return available;
+
+    auto &rd=readers[reader]; // Just for shorthand
+    boost::posix_time::ptime deadline=boost::posix_time::microsec_clock::universal_time()+
+                                      boost::posix_time::milliseconds(timeout_msec);
+
+    while (true) {
+        rd.wake_seq.store(rd.seq.load(std::memory_order_relaxed)+min_n,std::memory_order_seq_cst);
+
+        available=read_available(reader);
+        if (available>=min_n)
+            break;
+        if (!rd.wake_sem.timed_wait(deadline)) {
+            available=read_available(reader);
+            break;
+        }
+    }
+    rd.wake_seq.store(0,std::memory_order_seq_cst);
+
+    return available;
+}
+
+template <typename T>
+size_t mwmr_ringbuffer<T>::read_wait(size_t reader,T* read_buf,size_t min_n,size_t max_n,unsigned long timeout_msec)
+{
+    wait_available(reader,min_n,timeout_msec);
+    return read(reader,read_buf,max_n);
+}
+
+template <typename T>
+swmr_region<const T> mwmr_ringbuffer<T>::acquire_read(size_t reader,size_t max_n)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in mwmr_ringbuffer::acquire_read");
+
+    auto &rd=readers[reader]; // Just for shorthand
+    uint64_t published=buf->publish_seq.load(std::memory_order_acquire);
+    uint64_t read_seq =skip_lost(rd.seq.load(std::memory_order_relaxed),buf->reserve_seq.load(std::memory_order_relaxed));
+    rd.seq.store(read_seq,std::memory_order_release);
+
+    size_t n=(published>read_seq)? published-read_seq : 0;
+    if (n>max_n)
+        n=max_n;
+
+    acquired_seq[reader]=read_seq;
+    acquired_n[reader]  =n;
+
+    swmr_region<const T> region;
+    size_t index=read_seq % buf_size;
+    region.data1=data+index;
+    region.n1=buf_size-index;
+    if (n>region.n1) {
+        region.data2=data;
+        region.n2=n-region.n1;
+    } else
+        region.n1=n;
+
+    return region;
+}
+
+template <typename T>
+size_t mwmr_ringbuffer<T>::release_read(size_t reader,size_t n)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in mwmr_ringbuffer::release_read");
+    if (n>acquired_n[reader])
+        throw std::invalid_argument("mwmr_ringbuffer::release_read: releasing more than acquired");
+
+    uint64_t start=acquired_seq[reader];
+    uint64_t end  =start+n;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t reserved=buf->reserve_seq.load(std::memory_order_relaxed);
+
+    size_t overwritten=0;
+    if (reserved > start+buf_size)
+        overwritten= (reserved-buf_size < end)? reserved-buf_size-start : n;
+
+    readers[reader].seq.store(end,std::memory_order_release);
+    acquired_seq[reader]=end;
+    acquired_n[reader] -= n;
+
+    return overwritten;
+}
+
+/*
+ * The published sequence number can be behind the read sequence number of a
+ * reader that has skipped lost data
+ */
+template <typename T>
+size_t mwmr_ringbuffer<T>::read_available(size_t reader)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in mwmr_ringbuffer::read_available");
+    uint64_t read_seq =readers[reader].seq.load(std::memory_order_acquire);
+    uint64_t published=buf->publish_seq.load(std::memory_order_seq_cst);
+    if (published<=read_seq)
+        return 0;
+    return (published-read_seq>buf_size)? buf_size : published-read_seq;
+}
+
+/*
+ * As swmr_ringbuffer::claim_reader()
+ */
+template <typename T>
+bool mwmr_ringbuffer<T>::claim_reader(size_t k,uint32_t pid)
+{
+    uint32_t owner=0;
+    if (readers[k].pid.compare_exchange_strong(owner,pid))
+        return true;
+    if (owner==pid || kill(owner,0)==0 || errno!=ESRCH)
+        return false;
+    return readers[k].pid.compare_exchange_strong(owner,pid);
+}
+
+template <typename T>
+void mwmr_ringbuffer<T>::activate_reader(size_t k,swmr_start start)
+{
+    auto &rd=readers[k]; // Just for shorthand
+    uint64_t reserved=buf->reserve_seq.load(std::memory_order_acquire);
+    uint64_t read_seq=buf->publish_seq.load(std::memory_order_acquire);
+    if (start==swmr_start::oldest)
+        read_seq=(reserved>buf_size)? reserved-buf_size : 0;
+
+    rd.wake_seq.store(0,std::memory_order_relaxed);
+    rd.seq.store(read_seq,std::memory_order_relaxed);
+    active[k/64].fetch_or(1ULL<<(k%64),std::memory_order_seq_cst);
+    attached[k]=true;
+    acquired_seq[k]=read_seq;
+    acquired_n[k]  =0;
+}
+
+template <typename T>
+size_t mwmr_ringbuffer<T>::attach_reader(swmr_start start)
+{
+    uint32_t pid=getpid();
+    for (int pass=0;pass<2;pass++) {
+        for (size_t k=0;k<num_readers;k++) {
+            uint32_t owner=0;
+            if ((pass==0)? readers[k].pid.compare_exchange_strong(owner,pid) : claim_reader(k,pid)) {
+                activate_reader(k,start);
+                return k;
+            }
+        }
+    }
+    throw std::runtime_error("mwmr_ringbuffer::attach_reader: all the readers are in use");
+}
+
+template <typename T>
+void mwmr_ringbuffer<T>::attach_reader(size_t reader,swmr_start start)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in mwmr_ringbuffer::attach_reader");
+    if (attached[reader] || !claim_reader(reader,getpid()))
+        throw std::runtime_error("mwmr_ringbuffer::attach_reader: reader "+std::to_string(reader)+" is in use");
+    activate_reader(reader,start);
+}
+
+template <typename T>
+void mwmr_ringbuffer<T>::detach_reader(size_t reader)
+{
+    if (reader>=num_readers || !attached[reader])
+        throw std::invalid_argument("mwmr_ringbuffer::detach_reader: reader not attached");
+
+    auto &rd=readers[reader]; // Just for shorthand
+    active[reader/64].fetch_and(~(1ULL<<(reader%64)),std::memory_order_seq_cst);
+    rd.wake_seq.store(0,std::memory_order_relaxed);
+    rd.pid.store(0,std::memory_order_release);
+    attached[reader]=false;
+}
+
+template <typename T>
+size_t mwmr_ringbuffer<T>::readers_offset()
+{
+    return (sizeof(shm_buf)+CACHE_LINE-1)/CACHE_LINE*CACHE_LINE;
+}
+
+template <typename T>
+size_t mwmr_ringbuffer<T>::active_offset(size_t max_readers)
+{
+    return readers_offset()+max_readers*sizeof(reader_descr);
+}
+
+template <typename T>
+size_t mwmr_ringbuffer<T>::committed_offset(size_t max_readers)
+{
+    size_t offset=active_offset(max_readers)+(max_readers+63)/64*sizeof(std::atomic<uint64_t>);
+    return (offset+CACHE_LINE-1)/CACHE_LINE*CACHE_LINE;
+}
+
+template <typename T>
+size_t mwmr_ringbuffer<T>::data_offset(uint64_t buf_size,size_t max_readers)
+{
+    size_t offset=committed_offset(max_readers)+buf_size*sizeof(std::atomic<uint64_t>);
+    return (offset+CACHE_LINE-1)/CACHE_LINE*CACHE_LINE;
+}
+
+/*
+ * Extra CACHE_LINE bytes, so that the structure can be aligned in the segment
+ */
+template <typename T>
+size_t mwmr_ringbuffer<T>::get_shm_size(uint64_t buf_size,size_t max_readers)
+{
+    return data_offset(buf_size,max_readers)+buf_size*sizeof(T)+CACHE_LINE;
+}
+
+/*
+ * As swmr_ringbuffer::construct(), the structure is an array of bytes in the
+ * segment, aligned to CACHE_LINE
+ */
+template <typename T>
+bool mwmr_ringbuffer<T>::construct(
+                           const char * name,
+                           boost::interprocess::managed_shared_memory& segment,
+                           uint64_t buf_size,
+                           size_t max_readers
+                         )
+{
+    if (buf_size==0)
+        throw std::invalid_argument("mwmr_ringbuffer::construct: buffer size must be > 0");
+    if (max_readers==0 || max_readers>UINT32_MAX)
+        throw std::invalid_argument("mwmr_ringbuffer::construct: max number of readers must be > 0 and fit in 32 bits");
+
+    char *mem=segment.construct<char>( name )[get_shm_size(buf_size,max_readers)]();
+    mem+=(CACHE_LINE - reinterpret_cast<uintptr_t>(mem)%CACHE_LINE)%CACHE_LINE;
+
+    shm_buf *hdr=new (mem) shm_buf();
+    hdr->magic      =SHM_MAGIC;
+    hdr->version    =SHM_VERSION;
+    hdr->elem_size  =sizeof(T);
+    strncpy(hdr->elem_type,typeid(T).name(),sizeof(hdr->elem_type)-1);
+    hdr->max_readers=max_readers;
+    hdr->buf_size   =buf_size;
+
+    for (size_t k=0;k<max_readers;k++)
+        new (mem+readers_offset()+k*sizeof(reader_descr)) reader_descr();
+    for (size_t w=0;w<(max_readers+63)/64;w++)
+        new (mem+active_offset(max_readers)+w*sizeof(std::atomic<uint64_t>)) std::atomic<uint64_t>(0);
+    for (uint64_t k=0;k<buf_size;k++)
+        new (mem+committed_offset(max_readers)+k*sizeof(std::atomic<uint64_t>)) std::atomic<uint64_t>(0);
+
+    return true;
+}
+
+template <typename T>
+bool mwmr_ringbuffer<T>::remove(
+                       const char * name,
+                       boost::interprocess::managed_shared_memory& segment
+                      )
+{
+    segment.destroy<char>(name);
+    return true;
+}
+
+template <typename T>
+mwmr_ringbuffer<T>::mwmr_ringbuffer(const char * name,boost::interprocess::managed_shared_memory& segment)
+{
+    char *mem=segment.find<char>( name ).first;
+    if (mem==NULL)
+        throw std::runtime_error(std::string("mwmr_ringbuffer: cannot find ")+name);
+    mem+=(CACHE_LINE - reinterpret_cast<uintptr_t>(mem)%CACHE_LINE)%CACHE_LINE;
+
+    buf=reinterpret_cast<shm_buf*>(mem);
+    if (buf->magic!=SHM_MAGIC || buf->version!=SHM_VERSION)
+        throw std::runtime_error(std::string("mwmr_ringbuffer: ")+name+" is not a ring buffer or has a different version");
+    if (buf->elem_size!=sizeof(T) || strncmp(buf->elem_type,typeid(T).name(),sizeof(buf->elem_type)-1)!=0)
+        throw std::runtime_error(std::string("mwmr_ringbuffer: ")+name+" has been created for elements of type "+buf->elem_type);
+
+    buf_size    =buf->buf_size;
+    num_readers =buf->max_readers;
+    readers     =reinterpret_cast<reader_descr*>(mem+readers_offset());
+    active      =reinterpret_cast<std::atomic<uint64_t>*>(mem+active_offset(num_readers));
+    active_words=(num_readers+63)/64;
+    committed   =reinterpret_cast<std::atomic<uint64_t>*>(mem+committed_offset(num_readers));
+    data        =reinterpret_cast<T*>(mem+data_offset(buf_size,num_readers));
+    attached.assign(num_readers,false);
+    acquired_seq.assign(num_readers,0);
+    acquired_n.assign(num_readers,0);
+}
+
+template <typename T>
+mwmr_ringbuffer<T>::~mwmr_ringbuffer()
+{
+    for (size_t k=0;k<attached.size();k++)
+        if (attached[k])
+            detach_reader(k);
+}
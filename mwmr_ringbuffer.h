@@ -0,0 +1,252 @@
+#ifndef __MWMR_RINGBUFFER
+#define __MWMR_RINGBUFFER
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <boost/interprocess/sync/interprocess_semaphore.hpp>
+#include <boost/interprocess/managed_shared_memory.hpp>
+
+#include "swmr_ringbuffer.h"
+
+
+/**
+ * Multiple Writer, Multiple Reader ring buffer.
+ *
+ * The sibling of swmr_ringbuffer for the case where several processes write into
+ * the same stream (fan-in). The readers use the same interface as with
+ * swmr_ringbuffer: each reader attaches with attach_reader() and independently reads
+ * the whole sequence, losing the oldest data if it is too slow.
+ *
+ * It is always lock-free:
+ *  - A writer claims the positions of its elements with an atomic fetch-add on the
+ *    reservation sequence number, copies the data and then sets, for each element,
+ *    a commit flag (the sequence number of the element stored in that slot).
+ *  - The elements are published to the readers in sequence order, up to the first one
+ *    not committed yet, so the readers never see a region being written. Whichever
+ *    writer commits moves forward the published sequence number as far as possible.
+ *  - The reservation sequence number tells the readers what is about to be overwritten,
+ *    as 'write_claim' does for swmr_ringbuffer.
+ * The elements of one write() are contiguous, and the writes of one writer are in the
+ * order they were done. Writes of different writers are interleaved in the order of
+ * their reservations.
+ *
+ * A writer that laps another one (a whole buffer ahead) waits for it to commit before
+ * overwriting its slots. A writer that dies between reserving and committing stalls the
+ * readers at its region until the other writers have written a whole buffer after it:
+ * its region is then skipped as lost.
+ *
+ * The commit flags take 8 bytes per element, in addition to the data.
+ *
+ * Zero-copy writes (reserve_write()/commit_write()), the overflow policies and the
+ * placement options of swmr_ringbuffer are not available.
+ */
+template <typename T> class mwmr_ringbuffer {
+
+public:
+    /// See swmr_ringbuffer::attach_reader()
+    size_t attach_reader(
+                         swmr_start start=swmr_start::oldest ///< where to start reading >.
+                        );
+
+    /// See swmr_ringbuffer::attach_reader()
+    void attach_reader(
+                       size_t reader_id,                    ///< Identifier of the reader >.
+                       swmr_start start=swmr_start::oldest  ///< where to start reading >.
+                      );
+
+    /// See swmr_ringbuffer::detach_reader()
+    void detach_reader(
+                       size_t reader_id ///< Identifier of the reader >.
+                      );
+
+    /**
+     * Writes 'n' elements in the ring buffer, contiguously in the sequence. Can be
+     * called by any number of processes/threads at the same time.
+     * Only the first buf_size elements are written, if 'n' is bigger.
+     *
+     * @returns the number of points written
+     */
+    size_t write(
+                const T* data,  ///< pointer to 'n' elements to write >.
+                size_t n        ///< number of elements to write >.
+                );
+
+    /**
+     * Writes a single data element.
+     */
+    void write(
+              const T& data ///< single element to write >.
+              ) { write(&data,1); }
+
+    /// See swmr_ringbuffer::read()
+    size_t read(
+                size_t reader_id, ///< Identifier of the reader >.
+                T* read_buf,      ///< Pointer  to where the read data will be copied>.
+                size_t n          ///< number of elements to read >.
+               );
+
+    /// See swmr_ringbuffer::read_wait()
+    size_t read_wait(
+                     size_t reader_id,          ///< Identifier of the reader >.
+                     T* read_buf,               ///< Pointer  to where the read data will be copied>.
+                     size_t min_n,              ///< number of elements to wait for >.
+                     size_t max_n,              ///< max number of elements to read >.
+                     unsigned long timeout_msec ///< max time to wait (milliseconds) >.
+                    );
+
+    /// See swmr_ringbuffer::wait_available()
+    size_t wait_available(
+                          size_t reader_id,          ///< Identifier of the reader >.
+                          size_t min_n,              ///< number of elements to wait for >.
+                          unsigned long timeout_msec ///< max time to wait (milliseconds) >.
+                         );
+
+    /// See swmr_ringbuffer::acquire_read()
+    swmr_region<const T> acquire_read(
+                                      size_t reader_id, ///< Identifier of the reader >.
+                                      size_t max_n      ///< max number of elements >.
+                                     );
+
+    /// See swmr_ringbuffer::release_read()
+    size_t release_read(
+                        size_t reader_id, ///< Identifier of the reader >.
+                        size_t n          ///< number of elements to release >.
+                       );
+
+    /// See swmr_ringbuffer::read_available()
+    size_t read_available(
+                          size_t reader_id ///< Identifier of the reader >.
+                         );
+
+    /**
+     * Returns the size of the buffer (how many elements it can hold).
+     */
+    uint64_t capacity() const { return buf_size; }
+
+    /**
+     * Returns the max number of readers.
+     */
+    size_t max_readers() const { return num_readers; }
+
+    /**
+     * Returns the size of the shared memory data structure, for a buffer of
+     * 'buf_size' elements and 'max_readers' readers.
+     */
+    static size_t get_shm_size(
+                               uint64_t buf_size,  ///< size of the buffer (elements) >.
+                               size_t max_readers  ///< max number of readers >.
+                              );
+
+    /**
+     * Build the data structure in shared memory (see swmr_ringbuffer::construct()).
+     * Will throw 'std::invalid_argument' if the parameters are not valid.
+     */
+    static bool construct(
+                           const char * name,
+                           boost::interprocess::managed_shared_memory& segment,
+                           uint64_t buf_size,  ///< size of the buffer (elements) >.
+                           size_t max_readers  ///< max number of readers >.
+                         );
+
+    /**
+     * Destroys the shared memeory data structure.
+     */
+    static bool remove(
+                       const char * name,
+                       boost::interprocess::managed_shared_memory& segment
+                      );
+
+    /**
+     * Attaches to the data structure created with construct(). Will throw
+     * 'std::runtime_error' if it is not found or if it was created for a
+     * different element type.
+     */
+    mwmr_ringbuffer(
+                    const char * name,
+                    boost::interprocess::managed_shared_memory& segment
+                   );
+
+    ~mwmr_ringbuffer();
+
+    mwmr_ringbuffer(const mwmr_ringbuffer&) = delete;
+    mwmr_ringbuffer& operator=(const mwmr_ringbuffer&) = delete;
+
+private:
+
+    static_assert(ATOMIC_LLONG_LOCK_FREE==2,"mwmr_ringbuffer requires lock-free 64-bit atomics");
+
+    static const uint32_t SHM_MAGIC=0x524d574d; // "MWMR"
+    static const uint32_t SHM_VERSION=1;
+    static const size_t CACHE_LINE=64;
+
+    // The header of the data structure in shared memory. It is followed by the
+    // descriptors of the readers, the mask of the attached readers, the commit
+    // flags and the data.
+    struct shm_buf
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t elem_size;
+        char     elem_type[48];
+        uint32_t max_readers;
+        uint64_t buf_size;
+
+        // Sequence number of the next element to reserve: the writers fetch-add it
+        alignas(CACHE_LINE) std::atomic<uint64_t> reserve_seq;
+
+        // All the elements before this are committed (or lost): the readers read up to here
+        alignas(CACHE_LINE) std::atomic<uint64_t> publish_seq;
+    } *buf=NULL;
+
+    // As for swmr_ringbuffer
+    struct alignas(CACHE_LINE) reader_descr {
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> wake_seq;
+        boost::interprocess::interprocess_semaphore wake_sem;
+        std::atomic<uint32_t> pid;
+
+        reader_descr() : seq(0), wake_seq(0), wake_sem(0), pid(0) {}
+    } *readers=NULL;
+
+    std::atomic<uint64_t> *active=NULL;
+    size_t active_words=0;
+
+    // For each slot, 1 + the sequence number of the last element committed in it
+    // (0 if none yet)
+    std::atomic<uint64_t> *committed=NULL;
+
+    T *data=NULL;
+
+    uint64_t buf_size=0;
+    size_t   num_readers=0;
+
+    static size_t readers_offset();
+    static size_t active_offset(size_t max_readers);
+    static size_t committed_offset(size_t max_readers);
+    static size_t data_offset(uint64_t buf_size,size_t max_readers);
+
+    // Moves forward the published sequence number over the committed elements,
+    // and wakes up the readers waiting for them
+    void publish();
+
+    // Skips what is lost for a reader at 'read_seq'
+    uint64_t skip_lost(uint64_t read_seq,uint64_t reserve_seq) const
+    {
+        return (reserve_seq-read_seq > buf_size)? reserve_seq-buf_size : read_seq;
+    }
+
+    bool claim_reader(size_t k,uint32_t pid);
+    void activate_reader(size_t k,swmr_start start);
+
+    std::vector<bool>     attached;
+    std::vector<uint64_t> acquired_seq;
+    std::vector<size_t>   acquired_n;
+};
+
+
+#include "mwmr_ringbuffer.cpp"
+
+#endif
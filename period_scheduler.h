@@ -0,0 +1,261 @@
+#ifndef __PERIOD_SCHEDULER
+#define __PERIOD_SCHEDULER
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+
+/**
+ * What a period_scheduler does when an action has run past the next deadline
+ */
+enum class period_catch_up {
+    /// Skip the deadlines already past: the next action is at the first deadline
+    /// in the future (the ticks skipped are counted, see period_stats)
+    skip,
+    /// Run the actions of the deadlines already past one after the other, without
+    /// waiting, until the schedule is caught up
+    burst
+};
+
+
+/**
+ * Histogram of durations, with buckets of powers of 2 microseconds: bucket 0 counts
+ * the durations below 1 us, bucket k those from 2^(k-1) to 2^k us (the last one
+ * also the longer ones).
+ */
+struct duration_histogram {
+    static const size_t BUCKETS=32;
+
+    uint64_t buckets[BUCKETS]={};
+    uint64_t count=0;
+    uint64_t total_ns=0;
+    uint64_t max_ns=0;
+
+    void add(uint64_t ns)
+    {
+        uint64_t us=ns/1000;
+        size_t k=0;
+        while (us>0 && k<BUCKETS-1) {
+            us>>=1;
+            k++;
+        }
+        buckets[k]++;
+        count++;
+        total_ns+=ns;
+        if (ns>max_ns)
+            max_ns=ns;
+    }
+
+    /// Upper bound of the bucket of the percentile 'p' (0..100), in us (the max for
+    /// the last bucket)
+    double percentile_us(double p) const
+    {
+        if (count==0)
+            return 0;
+        uint64_t rank=uint64_t(p/100*(count-1))+1;
+        uint64_t seen=0;
+        for (size_t k=0;k<BUCKETS-1;k++) {
+            seen+=buckets[k];
+            if (seen>=rank)
+                return std::min<double>(uint64_t(1)<<k,max_ns/1000.0);
+        }
+        return max_ns/1000.0;
+    }
+
+    /// "p50 X us p99 Y us max Z us"
+    std::string summary() const
+    {
+        std::ostringstream out;
+        out << "p50 " << percentile_us(50) << " us p99 " << percentile_us(99) << " us max " << max_ns/1000.0 << " us";
+        return out.str();
+    }
+};
+
+
+/**
+ * Counters of a period_scheduler
+ */
+struct period_stats {
+    uint64_t ticks=0;            ///< actions run
+    uint64_t overruns=0;         ///< times the next deadline was already past after an action
+    uint64_t skipped=0;          ///< deadlines skipped (period_catch_up::skip)
+    duration_histogram jitter;   ///< how late each action started, after its deadline
+    duration_histogram overrun;  ///< how late the next deadline was already, at each overrun
+};
+
+
+/**
+ * Repeats an action periodically, at the deadlines start+interval, start+2*interval...
+ * The deadlines are absolute times of std::chrono::steady_clock (on Linux waited for
+ * with clock_nanosleep(TIMER_ABSTIME) on CLOCK_MONOTONIC): the schedule does not drift
+ * and does not jump with the changes of the wall clock (NTP, DST).
+ *
+ * An action that runs longer than the interval is an overrun: the next deadline is
+ * already past. It is counted, and the schedule catches up as chosen (see
+ * period_catch_up). How late each action starts (the jitter of the wake ups) and how
+ * late the deadline is at each overrun are recorded in histograms (see stats()).
+ *
+ * Not thread safe: stats() and tick() are to be called by the action, or after run().
+ */
+class period_scheduler {
+public:
+    period_scheduler(
+                     std::chrono::nanoseconds interval,                 ///< time between two deadlines >.
+                     period_catch_up catch_up=period_catch_up::burst    ///< what to do after an overrun >.
+                    ) : interval(interval), catch_up(catch_up)
+    {
+        if (interval.count()<=0)
+            throw std::invalid_argument("period_scheduler: the interval must be > 0");
+    }
+
+    /**
+     * Runs 'action' at each deadline while 'condition' returns true (checked after
+     * each action). The first deadline is one interval from now.
+     */
+    void run(
+             std::function< void() > action,   ///< what to do >.
+             std::function< bool() > condition ///< repeat while this returns true >.
+            )
+    {
+        using clock=std::chrono::steady_clock;
+        clock::time_point deadline=clock::now()+interval;
+        n_tick=1;
+
+        while (true) {
+            sleep_until(deadline);
+            st.jitter.add(ns(clock::now()-deadline));
+            st.ticks++;
+
+            action();
+            if (!condition())
+                break;
+
+            deadline+=interval;
+            n_tick++;
+            clock::time_point now=clock::now();
+            if (now>deadline) {
+                st.overruns++;
+                st.overrun.add(ns(now-deadline));
+                if (catch_up==period_catch_up::skip) {
+                    uint64_t missed=(now-deadline)/interval+1;
+                    deadline+=missed*interval;
+                    n_tick+=missed;
+                    st.skipped+=missed;
+                }
+            }
+        }
+    }
+
+    /// Index of the current deadline (1 for the first): it is at start+tick()*interval
+    uint64_t tick() const { return n_tick; }
+
+    /// The counters since the start of run()
+    const period_stats& stats() const { return st; }
+
+private:
+    static uint64_t ns(std::chrono::steady_clock::duration d)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    }
+
+    static void sleep_until(std::chrono::steady_clock::time_point t)
+    {
+#ifdef __linux__
+        // steady_clock is CLOCK_MONOTONIC
+        auto since_epoch=std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+        timespec ts;
+        ts.tv_sec =since_epoch/1000000000;
+        ts.tv_nsec=since_epoch%1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL)==EINTR)
+            ;
+#else
+        std::this_thread::sleep_until(t);
+#endif
+    }
+
+    std::chrono::nanoseconds interval;
+    period_catch_up catch_up;
+    uint64_t n_tick=0;
+    period_stats st;
+};
+
+
+/**
+ * Parses a list of cpus, e.g. "0,2,4". Will throw 'std::invalid_argument' if it is
+ * not valid.
+ */
+inline std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::istringstream in(list);
+    std::string cpu;
+    while (std::getline(in,cpu,',')) {
+        size_t end=0;
+        int c=-1;
+        try {
+            c=std::stoi(cpu,&end);
+        } catch (std::exception &e) {
+        }
+        if (c<0 || end!=cpu.size())
+            throw std::invalid_argument("bad cpu '"+cpu+"'");
+#ifdef __linux__
+        if (c>=CPU_SETSIZE)
+            throw std::invalid_argument("bad cpu '"+cpu+"'");
+#endif
+        cpus.push_back(c);
+    }
+    if (cpus.empty())
+        throw std::invalid_argument("no cpu in '"+list+"'");
+    return cpus;
+}
+
+
+/**
+ * Pins the calling thread to 'cpus' (if not empty) and gives it the SCHED_FIFO
+ * real-time 'fifo_priority' (if >0). The threads it starts afterwards inherit both.
+ * Will throw 'std::runtime_error' if it is not allowed (SCHED_FIFO needs
+ * CAP_SYS_NICE or an 'ulimit -r' high enough) or not supported (Linux only).
+ */
+inline void set_thread_scheduling(
+                                  int fifo_priority,             ///< 0: don't change the policy >.
+                                  const std::vector<int>& cpus   ///< empty: don't change the affinity >.
+                                 )
+{
+    if (cpus.empty() && fifo_priority<=0)
+        return;
+#ifdef __linux__
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c : cpus)
+            CPU_SET(c,&set);
+        int err=pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+        if (err!=0)
+            throw std::runtime_error(std::string("can't set the cpu affinity: ")+strerror(err));
+    }
+    if (fifo_priority>0) {
+        sched_param param;
+        param.sched_priority=fifo_priority;
+        int err=pthread_setschedparam(pthread_self(),SCHED_FIFO,&param);
+        if (err!=0)
+            throw std::runtime_error("can't set the SCHED_FIFO priority "+std::to_string(fifo_priority)+
+                                     " (needs CAP_SYS_NICE or 'ulimit -r'): "+strerror(err));
+    }
+#else
+    throw std::runtime_error("cpu affinity and SCHED_FIFO are only supported on Linux");
+#endif
+}
+
+#endif
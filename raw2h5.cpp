@@ -0,0 +1,196 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/parsers.hpp>
+
+#include "cmn.h"
+#include "data_sink.h"
+
+using namespace std;
+using namespace boost;
+
+// Converter of the raw files written by the reader ('--format raw', see data_sink.h)
+// to HDF5 files, as written by the reader with '--format hdf5': 'X.rbin' is
+// converted to 'X.h5'. The raw file is mapped in memory and written with the HDF5
+// sink of the reader, so the same chunking and filters can be chosen.
+// A raw file that was not closed (the reader was killed) is converted up to its
+// last complete frame. The channels are stored as in the raw file (a 2-D dataset), or
+// in a dataset each with '--per-channel'.
+
+
+// The frames are converted this many at a time
+static const uint64_t BLOCK_FRAMES=1<<20;
+
+
+//------------- Modified using command line arguments --------
+vector<string> file_names;
+size_t chunk_points=65536;     // frames per chunk
+h5_filters filters;
+bool per_channel=false;
+unsigned int n_threads=2;
+bool quiet=false;
+
+void parse_args(int argc,char *argv[]);
+
+
+
+/**
+ * Converts one file. Returns false on error.
+ */
+static bool convert(const string& raw_name,worker_pool& pool)
+{
+    int fd=open(raw_name.c_str(),O_RDONLY);
+    struct stat st;
+    if (fd<0 || fstat(fd,&st)!=0) {
+        cerr << "ERROR: can't open " << raw_name << endl;
+        if (fd>=0)
+            close(fd);
+        return false;
+    }
+    if (size_t(st.st_size)<sizeof(raw_header)) {
+        cerr << "ERROR: " << raw_name << " is not a raw file" << endl;
+        close(fd);
+        return false;
+    }
+    void *map=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if (map==MAP_FAILED) {
+        cerr << "ERROR: can't map " << raw_name << endl;
+        return false;
+    }
+
+    const raw_header *header=static_cast<const raw_header*>(map);
+    uint64_t n_frames=header->n_frames;
+    unsigned int channels=header->channels? header->channels : 1;
+    bool ok=true;
+    if (memcmp(header->magic,RAW_MAGIC,sizeof(header->magic))!=0 || header->header_size<sizeof(raw_header)) {
+        cerr << "ERROR: " << raw_name << " is not a raw file" << endl;
+        ok=false;
+    } else if (header->elem_size!=sizeof(data_point_t) || strcmp(header->dtype,raw_dtype<data_point_t>::name())!=0) {
+        cerr << "ERROR: " << raw_name << " has elements of type " << header->dtype << ", not " << raw_dtype<data_point_t>::name() << endl;
+        ok=false;
+    } else if (n_frames==0) {
+        // Not closed
+        n_frames=(st.st_size-header->header_size)/(header->elem_size*channels);
+    }
+
+    if (ok) {
+        string base=raw_name;
+        if (base.size()>5 && base.compare(base.size()-5,5,".rbin")==0)
+            base.erase(base.size()-5);
+        try {
+            h5_sink<data_point_t> sink(DATASET_NAME,H5::PredType::IEEE_F64LE,header->sample_rate,chunk_points,filters,pool,
+                                       channels,per_channel? h5_layout::per_channel : h5_layout::interleaved);
+            sink.open(base);
+            const data_point_t *data=reinterpret_cast<const data_point_t*>(static_cast<const char*>(map)+header->header_size);
+            for (uint64_t k=0;k<n_frames;k+=BLOCK_FRAMES)
+                sink.append(data+k*channels,min(BLOCK_FRAMES,n_frames-k),header->first_index+k);
+            sink.close();
+            if (!quiet)
+                cout << raw_name << " -> " << sink.file_name() << ": " << n_frames << " frames of " << channels
+                     << " data points from " << header->first_index << endl;
+        } catch (std::exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            ok=false;
+        } catch (H5::Exception &e) {
+            cerr << "ERROR: " << e.getDetailMsg() << endl;
+            ok=false;
+        }
+    }
+
+    munmap(map,st.st_size);
+    return ok;
+}
+
+
+
+int main(int argc,char *argv[])
+{
+    parse_args(argc,argv);
+
+    worker_pool pool(n_threads);
+    bool ok=true;
+    for (auto &name : file_names)
+        ok=convert(name,pool) && ok;
+
+    return ok? 0 : -1;
+}
+
+
+
+/**
+ * Parsing command line arguments, using BOOST.
+ * See BOOST documentation for details.
+ */
+void parse_args(int argc,char *argv[])
+{
+    namespace po = boost::program_options;
+
+    // Declare the supported options.
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+        ("help", "write this help message")
+        ("quiet", "don't print any message")
+        ("chunk", po::value<size_t>(), "frames per chunk of the dataset (default: 65536)")
+        ("shuffle", "apply the shuffle filter to the chunks")
+        ("deflate", po::value<int>(), "compress the chunks with deflate, with this level (1..9)")
+        ("threads", po::value<unsigned int>(), "threads applying the filters to the chunks (default: 2)")
+        ("per-channel", "one dataset per channel (dset_0, dset_1...) instead of a 2-D dataset [frames x channels]")
+        ("file", po::value<vector<string>>(), "raw files to convert")
+    ;
+    po::positional_options_description files;
+    files.add("file",-1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc,argv).options(desc).positional(files).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << "raw2h5 [options] file.rbin ..." << endl << desc << "\n";
+        exit(0);
+    }
+
+    if (vm.count("quiet"))
+        quiet=true;
+
+    if (vm.count("chunk")) {
+        chunk_points= vm["chunk"].as<size_t>();
+        if (chunk_points==0) {
+            cerr << "ERROR: the chunk size must be > 0" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("shuffle"))
+        filters.shuffle= true;
+
+    if (vm.count("deflate")) {
+        filters.deflate= vm["deflate"].as<int>();
+        if (filters.deflate<1 || filters.deflate>9) {
+            cerr << "ERROR: the deflate level must be 1..9" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("threads"))
+        n_threads= vm["threads"].as<unsigned int>();
+
+    if (vm.count("per-channel"))
+        per_channel= true;
+
+    if (vm.count("file"))
+        file_names= vm["file"].as<vector<string>>();
+    if (file_names.empty()) {
+        cerr << "ERROR: no file to convert" << endl;
+        exit(-1);
+    }
+}
@@ -0,0 +1,153 @@
+#include <unistd.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/parsers.hpp>
+
+#include "cmn.h"
+
+using namespace std;
+using namespace boost;
+
+// Monitor for the ring buffers of the generator/reader example.
+// Attaches read-only to the shared memory segment and periodically prints, like
+// 'vmstat', the rates of the writer and of each reader of the ring buffers (points
+// written/read/lost per second), the lag of each attached reader and the time spent
+// on the mutex. For the writer 'lost' are the points dropped because the buffer was
+// full (swmr_overflow::drop_newest); critical readers are marked with '*'. It does not interfere with the pipeline: nothing is written in shared memory.
+
+
+
+// Print the column titles every this many intervals
+static const unsigned int HEADER_EVERY=20;
+
+
+
+//------------- Modified using command line arguments --------
+vector<string> buf_names={RINGBUF_NAME1, RINGBUF_NAME2};
+double interval_sec=1;
+unsigned int n_reports=0; // how many intervals to print (0: until interrupted)
+
+void parse_args(int argc,char *argv[]);
+
+
+
+static void print_header()
+{
+    cout << left  << setw(14) << "ring" << setw(8) << "reader"
+         << right << setw(11) << "points/s" << setw(10) << "lost/s" << setw(10) << "overruns"
+                  << setw(11) << "lag" << setw(11) << "max_lag"
+                  << setw(11) << "wait_us/s" << setw(11) << "hold_us/s" << endl;
+}
+
+static void print_line(const string& ring,const string& who,
+                       double points,double lost,uint64_t overruns,
+                       const string& lag,const string& max_lag,
+                       double wait_ns,double hold_ns,double sec)
+{
+    cout << left  << setw(14) << ring << setw(8) << who
+         << right << fixed << setprecision(0)
+                  << setw(11) << points/sec << setw(10) << lost/sec << setw(10) << overruns
+                  << setw(11) << lag << setw(11) << max_lag
+                  << setw(11) << wait_ns/1000/sec << setw(11) << hold_ns/1000/sec << endl;
+}
+
+
+
+int main(int argc,char *argv[])
+{
+    parse_args(argc,argv);
+
+    try {
+        interprocess::managed_shared_memory segment(interprocess::open_read_only, SHARED_MEM_NAME);
+
+        vector<swmr_stats> prev;
+        for (auto &name : buf_names)
+            prev.push_back(shm_ringbuf::stats(name.c_str(),segment));
+        auto prev_time=chrono::steady_clock::now();
+
+        for (unsigned int n=0; n_reports==0 || n<n_reports; n++) {
+            this_thread::sleep_for(chrono::duration<double>(interval_sec));
+            auto now=chrono::steady_clock::now();
+            double sec=chrono::duration<double>(now-prev_time).count();
+            prev_time=now;
+
+            if (n%HEADER_EVERY==0)
+                print_header();
+
+            for (size_t b=0;b<buf_names.size();b++) {
+                swmr_stats st=shm_ringbuf::stats(buf_names[b].c_str(),segment);
+                const swmr_stats &p=prev[b];
+
+                print_line(buf_names[b],"writer",st.written-p.written,st.dropped-p.dropped,st.overruns-p.overruns,"-","-",
+                           st.lock_wait_ns-p.lock_wait_ns,st.lock_hold_ns-p.lock_hold_ns,sec);
+
+                for (size_t k=0;k<st.readers.size();k++) {
+                    const swmr_reader_stats &r =st.readers[k];
+                    const swmr_reader_stats &pr=p.readers[k];
+                    if (!r.active)
+                        continue;
+                    print_line(buf_names[b],to_string(k)+(r.critical? "*" : ""),r.read-pr.read,r.lost-pr.lost,r.overruns-pr.overruns,
+                               to_string(r.lag),to_string(r.max_lag),
+                               r.lock_wait_ns-pr.lock_wait_ns,r.lock_hold_ns-pr.lock_hold_ns,sec);
+                }
+                prev[b]=st;
+            }
+        }
+    } catch (std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+/**
+ * Parsing command line arguments, using BOOST.
+ * See BOOST documentation for details.
+ */
+void parse_args(int argc,char *argv[])
+{
+    namespace po = boost::program_options;
+
+    // Declare the supported options.
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+        ("help", "write this help message")
+        ("buf", po::value<vector<string>>()->multitoken(), "names of the ring buffers to monitor (default: all)")
+        ("interval", po::value<double>(), "seconds between two reports (default: 1)")
+        ("count", po::value<unsigned int>(), "number of reports (default: until interrupted)")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << desc << "\n";
+        exit(0);
+    }
+
+    if (vm.count("buf"))
+        buf_names= vm["buf"].as<vector<string>>();
+
+    if (vm.count("interval")) {
+        interval_sec= vm["interval"].as<double>();
+        if (interval_sec<=0) {
+            cerr << "ERROR: interval must be > 0" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("count"))
+        n_reports= vm["count"].as<unsigned int>();
+}
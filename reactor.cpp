@@ -0,0 +1,451 @@
+#include <unistd.h>
+#include <signal.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/parsers.hpp>
+
+#include "H5Cpp.h"
+
+#include "cmn.h"
+#include "data_sink.h"
+#include "transform_stages.h"
+#include "worker_pool.h"
+#include "drain_stats.h"
+#include "ring_reactor.h"
+
+
+using namespace std;
+using namespace boost;
+using namespace H5;
+
+// Serves many ring buffers in one process (see ring_reactor.h), instead of a
+// process per consumer, each with a timer of its own.
+// Each '--sink BUF:TAG' writes the points of the ring buffer BUF in HDF5 files
+// (data/TAG-testdata-NNN, as the reader), each '--transform IN:OUT' transforms the
+// points of IN into OUT (as the transformer, with the stages of '--stage' and
+// '--stages'). Every ring buffer is read by a reader of its own, woken up by the
+// writer when at least 'batch_size' points are available, or after
+// 'max_latency_msec' milliseconds at most; the handlers are run by 'n_threads'
+// threads. Each read takes all the points available, up to 'max_io_points'.
+// SIGINT and SIGTERM stop the handlers (the files are closed properly).
+
+
+/// Default max time to wait for data (msec)
+static const unsigned int INTERVAL_MSEC=40;
+
+/// How many points are written in an interval, by default
+static const unsigned int POINTS_PER_INTERVAL=(POINTS_PER_SEC/1000)*INTERVAL_MSEC;
+
+/// Default max points per read (when behind)
+static const unsigned int MAX_IO_POINTS=8*POINTS_PER_INTERVAL;
+
+
+// Names for the output files
+const char* file_name_dir="data";
+const char* file_name_prefix="testdata";
+
+
+//------------- Modified with the command line arguments --------
+vector<pair<string,string>> sinks;        // ring buffer, tag
+vector<pair<string,string>> transforms;   // input ring buffer, output ring buffer
+vector<string> stages;          // The transform stages, in order
+string stages_file;             // A file with more stages (after those of 'stages')
+unsigned int seconds_to_run=600;
+unsigned int points_per_sec=POINTS_PER_SEC;     // rate of the generator (frames)
+unsigned int file_size=2000000; // How many frames to write in every HDF5 file
+unsigned int n_threads=2;       // Threads running the handlers
+unsigned int batch_size=POINTS_PER_INTERVAL;    // How many points to wait for before waking up
+unsigned int max_latency_msec=INTERVAL_MSEC;    // Max time to wait for 'batch_size' points
+size_t max_io_points=MAX_IO_POINTS;     // Max points per read
+size_t chunk_points=65536;      // Frames per chunk of the datasets
+bool quiet=false;
+
+// Points per frame, from the shared memory segment
+unsigned int channels=1;
+
+void parse_args(int argc,char *argv[]);
+
+
+/**
+ * A ring buffer served by the reactor: its reader, and what is read
+ */
+class ring_consumer : public ring_handler {
+public:
+    ring_consumer(const string& name,interprocess::managed_shared_memory& segment) :
+        name(name), buf(new shm_ringbuf(name.c_str(),segment))
+    {
+        reader_id=buf->attach_reader(swmr_start::oldest,false);
+    }
+
+    virtual string describe() const=0;
+
+    string name;
+    unique_ptr<shm_ringbuf> buf;
+    size_t reader_id;
+    size_t points_left=size_t(seconds_to_run)*points_per_sec*channels;
+    drain_stats drain;
+};
+
+
+/**
+ * Writes the points of a ring buffer in HDF5 files of 'file_size' frames
+ */
+class sink_handler : public ring_consumer {
+public:
+    sink_handler(const string& name,const string& tag,interprocess::managed_shared_memory& segment) :
+        ring_consumer(name,segment), tag(tag), pool(0)
+    {
+        data.resize(max<size_t>(max_io_points/channels,1)*channels);
+    }
+
+    ~sink_handler()
+    {
+        if (file)
+            close_file();
+    }
+
+    bool service() override
+    {
+        // (whole frames only: the writer only writes whole frames)
+        size_t lag=min<size_t>(buf->read_available(reader_id),points_left);
+        auto region=buf->acquire_read(reader_id,min(data.size(),points_left));
+        size_t n=region.size()-region.size()%channels;
+        drain.read(n,lag);
+        size_t n1=min(n,region.n1);
+        copy(region.data1,region.data1+n1,data.begin());
+        copy(region.data2,region.data2+(n-n1),data.begin()+n1);
+
+        // The points overwritten while copying are dropped, with the rest of their
+        // frame (see reader.cpp)
+        size_t n_overwritten=buf->release_read(reader_id,n);
+        size_t first=0;
+        if (n_overwritten) {
+            first=min(n,(n_overwritten+channels-1)/channels*channels);
+            cerr << "Reactor: " << tag << ": WARNING " << first << " data points overwritten while reading" << endl;
+        }
+        points_left-=n;
+
+        for (size_t k=first;k<n;) {
+            if (!file)
+                open_file();
+            size_t n_write=min<size_t>((n-k)/channels,file_size-written);
+            file->append(data.data()+k,n_write,stream_index);
+            written+=n_write;
+            stream_index+=n_write;
+            k+=n_write*channels;
+            if (written==file_size)
+                close_file();
+        }
+        return points_left>0;
+    }
+
+    string describe() const override { return tag+" ("+name+" reader "+to_string(reader_id)+")"; }
+
+private:
+    void open_file()
+    {
+        file.reset(new h5_sink<data_point_t>(DATASET_NAME,PredType::IEEE_F64LE,points_per_sec,chunk_points,h5_filters(),pool,
+                                             channels,h5_layout::interleaved));
+        ostringstream out_file_name;
+        out_file_name << file_name_dir << "/" << tag << "-" << file_name_prefix << "-" << setfill('0') << setw(3) << file_num++;
+        file->open(out_file_name.str());
+        written=0;
+        if (!quiet)
+            cout << "Reactor: " << tag << ": Writing data points into " << file->file_name() << endl;
+    }
+
+    void close_file()
+    {
+        file->close();
+        file.reset();
+    }
+
+    string tag;
+    worker_pool pool;           // no threads: the filters are applied by the handler
+    vector<data_point_t> data;  // the points of a read
+    unique_ptr<h5_sink<data_point_t>> file;
+    size_t written=0;           // frames in the current file
+    unsigned long file_num=0;
+    uint64_t stream_index=0;
+};
+
+
+/**
+ * Transforms the points of a ring buffer into another one, with the stages
+ * chosen (as run_serial() of transformer.cpp)
+ */
+class transform_handler : public ring_consumer {
+public:
+    transform_handler(const string& in_name,const string& out_name,interprocess::managed_shared_memory& segment) :
+        ring_consumer(in_name,segment), out_name(out_name), buf_out(new shm_ringbuf(out_name.c_str(),segment)),
+        pipeline(channels)
+    {
+        for (auto &stage : stages)
+            pipeline.add(stage);
+        if (!stages_file.empty())
+            pipeline.add_file(stages_file);
+        if (pipeline.empty())
+            pipeline.add("transform");
+    }
+
+    bool service() override
+    {
+        // All the points available up to 'max_io_points', but never more than
+        // what can be written to the output
+        size_t max_n=min<size_t>(min<size_t>(buf_out->capacity(),max_io_points),points_left);
+        max_n=max<size_t>(max_n/channels,1)*channels;
+        size_t lag=min<size_t>(buf->read_available(reader_id),points_left);
+        auto region_in =buf->acquire_read(reader_id,max_n);
+        size_t n_frames=region_in.size()/channels;
+        auto region_out=buf_out->reserve_write(pipeline.out_frames(n_frames)*channels);
+        n_frames=min<uint64_t>(n_frames,pipeline.max_in_frames(region_out.size()/channels));
+        size_t n=n_frames*channels;
+        uint64_t first=pipeline.input_frames();
+
+        size_t n_out=0;
+        auto put=[&](const data_point_t* y,size_t m) {
+            for (size_t left=m*channels;left>0;) {
+                size_t n_contig;
+                data_point_t *dst=region_out.at(n_out,n_contig);
+                size_t c=min(n_contig,left);
+                copy(y,y+c,dst);
+                y+=c;
+                n_out+=c;
+                left-=c;
+            }
+        };
+        drain.read(n,lag);
+        size_t n1=min(n,region_in.n1);
+        pipeline.process(region_in.data1,n1/channels,put);
+        pipeline.process(region_in.data2,(n-n1)/channels,put);
+        points_left-=n;
+
+        // The frames output from the points overwritten while transforming are
+        // dropped (see transformer.cpp)
+        size_t n_overwritten=buf->release_read(reader_id,n);
+        if (n_overwritten) {
+            size_t n_drop=pipeline.out_frames(first,min(n_frames,(n_overwritten+channels-1)/channels))*channels;
+            cerr << "Reactor: " << name << ": WARNING " << n_overwritten << " data points overwritten while transforming" << endl;
+            for (size_t k=0;k+n_drop<n_out;k++) {
+                size_t n_contig;
+                *region_out.at(k,n_contig)=*region_out.at(k+n_drop,n_contig);
+            }
+            n_out -= n_drop;
+        }
+
+        buf_out->commit_write(n_out);
+        return points_left>0;
+    }
+
+    string describe() const override { return name+" -> "+out_name+" (reader "+to_string(reader_id)+")"; }
+
+private:
+    string out_name;
+    unique_ptr<shm_ringbuf> buf_out;
+    transform_pipeline pipeline;
+};
+
+
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc,argv);
+
+    // Setup for the ring buffers, which must have been ALREDAY CREATED (this
+    // just opens them)
+    interprocess::managed_shared_memory segment(interprocess::open_only, SHARED_MEM_NAME);
+    channels=get_channels(segment);
+
+    // The consumers, attached before the data starts
+    vector<std::shared_ptr<ring_consumer>> consumers;
+    try {
+        for (auto &t : transforms)
+            consumers.emplace_back(new transform_handler(t.first,t.second,segment));
+        for (auto &s : sinks)
+            consumers.emplace_back(new sink_handler(s.first,s.second,segment));
+    } catch (std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return -1;
+    }
+
+    ring_reactor<shm_ringbuf> reactor(n_threads);
+    for (auto &c : consumers)
+        reactor.add(*c->buf,c->reader_id,batch_size,chrono::milliseconds(max_latency_msec),c);
+
+    // SIGINT and SIGTERM stop the reactor. The signals are blocked in all the
+    // threads and received by a thread of their own (as in the reader)
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals,SIGINT);
+    sigaddset(&signals,SIGTERM);
+    pthread_sigmask(SIG_BLOCK,&signals,NULL);
+    atomic<bool> done(false);
+    thread signal_thread([&] {
+        timespec timeout={0,100000000};
+        while (!done) {
+            if (sigtimedwait(&signals,NULL,&timeout)>0)
+                reactor.stop();
+        }
+    });
+
+    auto t0=chrono::steady_clock::now();
+    int status=0;
+    try {
+        reactor.run();
+    } catch (std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        status=-1;
+    } catch (H5::Exception &e) {
+        cerr << "ERROR: " << e.getDetailMsg() << endl;
+        status=-1;
+    }
+    done=true;
+    signal_thread.join();
+    double sec=chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+
+    if (!quiet) {
+        cout << "Reactor: " << consumers.size() << " ring buffers on " << n_threads << " threads in " << sec << " s, "
+             << reactor.waits() << " waits" << endl;
+        for (size_t k=0;k<consumers.size();k++) {
+            auto &st=reactor.stats(k);
+            cout << "Reactor: " << consumers[k]->describe() << ": " << st.services << " services (" << st.notified << " notified, "
+                 << st.timeouts << " timeouts, " << st.ready << " ready), " << consumers[k]->drain.summary() << endl;
+        }
+    }
+    return status;
+}
+
+
+/**
+ * Splits "A:B" at the colon. Exits with an error if there is none.
+ */
+static pair<string,string> split_pair(const string& option,const string& value)
+{
+    size_t colon=value.find(':');
+    if (colon==string::npos || colon==0 || colon==value.size()-1) {
+        cerr << "ERROR: bad --" << option << " '" << value << "'" << endl;
+        exit(-1);
+    }
+    return make_pair(value.substr(0,colon),value.substr(colon+1));
+}
+
+
+/**
+ * Parsing command line arguments, using BOOST.
+ * See BOOST documentation for details.
+ */
+void parse_args(int argc,char *argv[])
+{
+    namespace po = boost::program_options;
+
+    // Declare the supported options.
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+        ("help", "write this help message")
+        ("quiet", "don't print any message")
+        ("sink", po::value<vector<string>>(), "BUF:TAG writes the points of the ring buffer BUF in the files data/TAG-testdata-NNN. Can be repeated")
+        ("transform", po::value<vector<string>>(), "IN:OUT transforms the points of the ring buffer IN into OUT. Can be repeated")
+        ("stage", po::value<vector<string>>(), "a transform stage (see transformer --help), applied by all the --transform. Can be repeated (default: 'transform')")
+        ("stages", po::value<string>(), "a file with transform stages, one per line, applied after those of --stage")
+        ("seconds", po::value<unsigned int>(), "how many seconds to run")
+        ("rate", po::value<unsigned int>(), "frames per second of the generator (default: POINTS_PER_SEC)")
+        ("size", po::value<unsigned int>(), "start a new file after this many frames (default: 2000000)")
+        ("threads", po::value<unsigned int>(), "threads running the handlers (default: 2)")
+        ("batch", po::value<unsigned int>(), "how many data points to wait for before reading")
+        ("latency", po::value<unsigned int>(), "max time to wait for data (msec)")
+        ("max-io", po::value<size_t>(), "max data points per read, when more are available (default: 8 intervals of POINTS_PER_SEC)")
+        ("chunk", po::value<size_t>(), "frames per chunk of the datasets (default: 65536)")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        cout << desc << "\n";
+        exit(0);
+    }
+
+    if (vm.count("quiet"))
+        quiet=true;
+
+    if (vm.count("sink"))
+        for (auto &s : vm["sink"].as<vector<string>>())
+            sinks.push_back(split_pair("sink",s));
+
+    if (vm.count("transform"))
+        for (auto &t : vm["transform"].as<vector<string>>())
+            transforms.push_back(split_pair("transform",t));
+
+    if (sinks.empty() && transforms.empty()) {
+        cerr << "ERROR: nothing to do (no --sink or --transform)" << endl;
+        exit(-1);
+    }
+    if (sinks.size()+transforms.size()>ring_reactor<shm_ringbuf>::MAX_RINGS) {
+        cerr << "ERROR: at most " << ring_reactor<shm_ringbuf>::MAX_RINGS << " ring buffers" << endl;
+        exit(-1);
+    }
+
+    if (vm.count("stage"))
+        stages= vm["stage"].as<vector<string>>();
+
+    if (vm.count("stages"))
+        stages_file= vm["stages"].as<string>();
+
+    if (vm.count("seconds"))
+        seconds_to_run= vm["seconds"].as<unsigned int>();
+
+    if (vm.count("rate"))
+        points_per_sec= vm["rate"].as<unsigned int>();
+
+    if (vm.count("size")) {
+        file_size= vm["size"].as<unsigned int>();
+        if (file_size==0) {
+            cerr << "ERROR: the file size must be > 0" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("threads")) {
+        n_threads= vm["threads"].as<unsigned int>();
+        if (n_threads==0) {
+            cerr << "ERROR: need at least 1 thread" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("batch"))
+        batch_size= vm["batch"].as<unsigned int>();
+
+    if (vm.count("latency"))
+        max_latency_msec= vm["latency"].as<unsigned int>();
+
+    if (vm.count("max-io")) {
+        max_io_points= vm["max-io"].as<size_t>();
+        if (max_io_points==0) {
+            cerr << "ERROR: the max I/O size must be > 0" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("chunk")) {
+        chunk_points= vm["chunk"].as<size_t>();
+        if (chunk_points==0) {
+            cerr << "ERROR: the chunk size must be > 0" << endl;
+            exit(-1);
+        }
+    }
+}
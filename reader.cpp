@@ -1,8 +1,16 @@
 #include <unistd.h>
+#include <signal.h>
+#include <cstdio>
 #include <string>
+#include <vector>
 #include <fstream>
+#include <iomanip>
 #include <sstream>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/variables_map.hpp>
@@ -11,8 +19,10 @@
 #include "H5Cpp.h"
 
 #include "cmn.h"
-
-#include "period_repeat.h"
+#include "data_sink.h"
+#include "buffer_queue.h"
+#include "drain_stats.h"
+#include "period_scheduler.h"
 
 
 using namespace std;
@@ -21,21 +31,40 @@ using namespace H5;
 
 // Reader for the generator/reader example.
 // This process reads data points from the ring buffer named 'ringbuffer_name' and
-// writes them on consecutive HDF5 files.
-// Each file will have either a fixed size or a random size, depending on a command
-// line parameter.
-// To evenly spread the CPU load, the reader wakes up every INTERVAL_MSEC
-// milliseconds and read the appropriate amount of data points to read POINTS_PER_SEC
-// points every seconds.
-// Each file will contain a single dataset.
-
-
-/// How frequently to wake up to read the points
+// writes them on consecutive HDF5 files (or raw binary files, see data_sink.h).
+// The main thread (the drain) only copies the points from the ring buffer into a
+// set of recycled buffers, queued to an I/O thread that writes them in the files
+// (so a slow write or a file rotation doesn't delay the next read). The next file
+// is created in advance by the I/O thread.
+// A new file is started after a number of points (fixed or random), of bytes, at
+// every period of time or on SIGUSR1, depending on command line parameters.
+// The reader is woken up by the writer when at least 'batch_size' points are
+// available to read, or after 'max_latency_msec' milliseconds at most. Each read
+// takes all the points available, up to 'max_io_points': after a stall the reader
+// catches up with reads of many intervals' worth of points, then goes back to small
+// reads of the points of one wake up (see drain_stats.h).
+// The ring buffer carries frames of one point per channel (see CHANNELS_NAME): the
+// points are always read and written in whole frames.
+// Each HDF5 file will contain a single, extensible and chunked dataset, 2-D with more
+// than one channel ([frames x channels]), or one 1-D dataset per channel with
+// '--per-channel'. The chunks can be
+// compressed (with the standard HDF5 filters): the filters are applied by a pool of
+// threads and the chunks are written already filtered, so the HDF5 library only
+// does the I/O.
+// In SWMR mode the HDF5 files can be read while they are written (see h5tail.cpp).
+// The reader itself is run(), on a ring buffer of a segment: main() runs it on the
+// shared memory segment, the launcher on a heap segment (see launcher.cpp).
+
+
+/// Default max time to wait for data (msec)
 static const unsigned int INTERVAL_MSEC=40;
 
-/// How many points max to read every time
+/// How many points are written in an interval, by default
 static const unsigned int POINTS_PER_INTERVAL=(POINTS_PER_SEC/1000)*INTERVAL_MSEC;
 
+/// Default max points per read (when behind)
+static const unsigned int MAX_IO_POINTS=8*POINTS_PER_INTERVAL;
+
 
 
 // Names for the output files and the dataset
@@ -46,109 +75,324 @@ const char* file_name_prefix="testdata";
 //------------- Modified with the command line arguments --------
 string tag;  // a prefix for the file names
 unsigned int seconds_to_run=600;
+unsigned int points_per_sec=POINTS_PER_SEC;     // rate of the generator
 unsigned int reader_id=0;
-unsigned int file_size=2000000; // How many points to write in every HDF5 file
+bool any_reader_id=true;                // if no Id is given, the first free one is used
+swmr_start start=swmr_start::oldest;    // where to start reading
+bool critical=false;                    // if the writer must not overwrite our data
+unsigned int file_size=2000000; // How many frames to write in every HDF5 file (0: random)
+bool size_rollover=true;        // if 'file_size' limits the files
+uint64_t roll_bytes=0;          // Max bytes stored in a file (0: no limit)
+unsigned int roll_period_sec=0; // Start a new file every this many seconds (0: never)
 string ringbuffer_name="";
 bool quiet=false;
+unsigned int batch_size=POINTS_PER_INTERVAL;    // How many points to wait for before waking up
+unsigned int max_latency_msec=INTERVAL_MSEC;    // Max time to wait for 'batch_size' points
+size_t max_io_points=MAX_IO_POINTS;     // Max points per read (and per buffer queued)
+size_t chunk_points=65536;      // Frames per chunk of the dataset (and per write)
+h5_filters filters;             // Filters applied to the chunks
+unsigned int n_threads=2;       // Threads applying the filters
+unsigned int n_buffers=8;       // Buffers between the drain and the I/O thread
+bool raw_output=false;          // Raw binary files instead of HDF5
+bool swmr=false;                // HDF5 files written in SWMR mode, to be read while written
+unsigned int flush_msec=1000;   // How often the data is flushed in SWMR mode
+bool per_channel=false;         // One dataset per channel, instead of a 2-D dataset
+int fifo_priority=0;    // SCHED_FIFO priority (0: normal scheduling)
+vector<int> cpus;       // cpus to run on (empty: any)
+
+// Points per frame, from the shared memory segment
+unsigned int channels=1;
 
 void parse_args(int argc,char *argv[]);
 
 
-int main(int argc, char *argv[])
-{
-    parse_args(argc,argv);
+// Set when the signals are received (by main(), or by the launcher)
+static atomic<bool> rotate_requested(false);  // SIGUSR1: start a new file
+static atomic<bool> stop_requested(false);    // SIGINT, SIGTERM: close the files and exit
 
-    // Setup for the ring buffer, which must have been ALREDAY CREATED (this
-    // just opens it)
-    interprocess::managed_shared_memory segment(interprocess::open_only, SHARED_MEM_NAME);
-    shm_ringbuf buf(ringbuffer_name.c_str(),segment);
 
+/**
+ * The sequence of output files, written by the I/O thread in the format chosen
+ * (a data_sink). A file is closed (and the next one started) when the first of the
+ * rollover policies triggers: number of frames, bytes stored, wall-clock period or
+ * explicit request (SIGUSR1).
+ * The next file is created as soon as the current one is started, so a rotation
+ * only costs the close of the full file.
+ */
+class output_files {
+public:
+    output_files(uint64_t ring_frames) : ring_frames(ring_frames), pool(n_threads)
+    {
+        next=open_next();
+    }
+
+    ~output_files()
+    {
+        close_current();
+        // The file created in advance is not needed
+        if (next)
+            next->sink->discard();
+    }
 
-    // Total points to read
-    size_t total_points=seconds_to_run*POINTS_PER_SEC;
+    /// Writes 'n' frames, on the next files if the current one is closed
+    void write(const data_point_t* data,size_t n)
+    {
+        while (n>0) {
+            if (!current)
+                start_next();
+
+            size_t n_write=n;
+            if (current->max_frames)
+                n_write=min(n,current->max_frames-current->written);
+            current->sink->append(data,n_write,stream_index);
+            current->written+=n_write;
+            stream_index+=n_write;
+            data+=n_write*channels;
+            n-=n_write;
+
+            if (roll_over())
+                close_current();
+        }
+    }
 
-    DataSpace *filespace=NULL;
-    DataSpace *memspace=NULL;
-    H5File *output_file=NULL;
-    DataSet dataset;
-    DataSpace dataspace;
-    unsigned long file_num=0; // will increment with each file generated
-    size_t points_in_file;    // how many data points in current file
-    size_t num_points;        // how many data points already read in current file
+private:
+    struct file_t {
+        size_t      max_frames=0;    // 0: no limit
+        size_t      written=0;
+        chrono::system_clock::time_point deadline;
+        unique_ptr<data_sink<data_point_t>> sink;
+    };
+
+    unique_ptr<file_t> open_next()
+    {
+        unique_ptr<file_t> f(new file_t);
+        if (raw_output)
+            f->sink.reset(new raw_sink<data_point_t>(points_per_sec,channels));
+        else {
+            auto sink=new h5_sink<data_point_t>(DATASET_NAME,PredType::IEEE_F64LE,points_per_sec,chunk_points,filters,pool,
+                                                channels,per_channel? h5_layout::per_channel : h5_layout::interleaved);
+            f->sink.reset(sink);
+            if (swmr)
+                sink->set_swmr(flush_msec);
+        }
+        ostringstream out_file_name;
+        out_file_name << file_name_dir << "/" << tag << "-" << file_name_prefix << "-" << setfill('0') << setw(3) << file_num++;
+        f->sink->open(out_file_name.str());
+        return f;
+    }
+
+    void start_next()
+    {
+        current=std::move(next);
+        next=open_next();
+
+        if (size_rollover) {
+            if (file_size==0) {
+                // File will contain a random number of frames
+                current->max_frames = 2000+double(rand())/RAND_MAX*1.2*ring_frames;
+            } else {
+                current->max_frames = file_size;
+            }
+        }
+        if (roll_period_sec) {
+            // The end of the current period, counting periods from the epoch (so
+            // they are aligned to the clock: every minute at :00...)
+            using namespace chrono;
+            auto now=duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+            current->deadline=system_clock::time_point(seconds((now/roll_period_sec+1)*roll_period_sec));
+        }
+        rotate_requested=false;
 
-    period_repeat(
+        if (!quiet)
+            cout << "Reader " << reader_id << ": Writing data points into " << current->sink->file_name() << endl;
+    }
 
-        INTERVAL_MSEC,  // How frequently to repeat
+    bool roll_over() const
+    {
+        return (current->max_frames && current->written==current->max_frames) ||
+               (roll_bytes && current->sink->bytes_stored()>=roll_bytes) ||
+               (roll_period_sec && chrono::system_clock::now()>=current->deadline) ||
+               rotate_requested;
+    }
 
-        // What to do each time
-        [&] {
-            // Need to open a new file?
-            if (output_file==NULL) {
-                ostringstream out_file_name;
-                out_file_name << file_name_dir << "/" << tag << "-" << file_name_prefix << "-" << setfill('0') << setw(3) << file_num++ << ".h5";
-                string filename=out_file_name.str();
-                output_file=new H5File(H5std_string(filename), H5F_ACC_TRUNC);
+    void close_current()
+    {
+        if (!current)
+            return;
+        current->sink->close();
+        if (!quiet)
+            cout << "Reader " << reader_id << ": " << current->written << " frames (" << current->written*channels*sizeof(data_point_t)
+                 << " bytes) written as " << current->sink->bytes_stored() << " bytes in " << current->sink->file_name() << endl;
+        current.reset();
+    }
 
-                if (file_size==0) {
-                    // File will contain a random number of data points
-                    points_in_file = 2000+double(rand())/RAND_MAX*1.2*BUF_SIZE;
-                } else {
-                    points_in_file =file_size;
-                }
-                // if we have only fewer points left to generate in total
-                if (total_points<points_in_file)
-                    points_in_file=total_points;
+    uint64_t ring_frames;
+    unsigned long file_num=0; // will increment with each file generated
+    uint64_t stream_index=0;  // index of the next frame in the output
+    worker_pool pool;
+    unique_ptr<file_t> current;
+    unique_ptr<file_t> next;
+};
 
 
-                num_points=0;
 
-                // Print a message just for feedback
-                if (!quiet)
-                    cout << "Reader " << reader_id << ": Writing " << points_in_file << " data points into " << filename << endl;
+/**
+ * Reads the points of the ring buffer 'ringbuffer_name' of 'segment' in the files,
+ * as chosen with the command line
+ */
+template <typename SEGMENT>
+int run(SEGMENT& segment)
+{
+    shm_ringbuf buf(ringbuffer_name.c_str(),segment);
+    channels=get_channels(segment);
 
+    try {
+        set_thread_scheduling(fifo_priority,cpus);
+    } catch (std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return -1;
+    }
+
+    // Attach as a reader, with the given Id or the first free one
+    try {
+        if (any_reader_id)
+            reader_id=buf.attach_reader(start,critical);
+        else
+            buf.attach_reader(reader_id,start,critical);
+    } catch (std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return -1;
+    }
 
-                hsize_t dim[1]={points_in_file};   // How many points in the dataset in this file
-                dataspace=DataSpace(1, dim);
-                dataset = output_file->createDataSet( H5std_string(DATASET_NAME), PredType::IEEE_F64LE, dataspace );
-            }
 
-            // Read from the ring buffer a chunk of up to POINTS_PER_INTERVAL points
-            // (fewer if the points left to write in the file are fewer)
-            size_t n_to_read= (points_in_file>POINTS_PER_INTERVAL)? POINTS_PER_INTERVAL : points_in_file;
-
-            data_point_t filebuf[POINTS_PER_INTERVAL];
-            unsigned int n=buf.read(reader_id,filebuf,n_to_read);
-
-            // Select the dataset hyperslab and write them
-            hsize_t memdim[1]={n};
-            hsize_t offset[1]={num_points};
-            hsize_t count[1]={n};
-            hsize_t stride[1]={1};
-            hsize_t block[1]={1};
-            DataSpace memspace(1, memdim);
-            dataspace.selectHyperslab(H5S_SELECT_SET, count, offset, stride, block);
-            dataset.write(filebuf, PredType::NATIVE_DOUBLE,memspace,dataspace);
-
-            num_points    += n;
-            points_in_file -= n;
-            total_points  -= n;
-
-            // If finished with the file, close it
-            if (points_in_file==0) {
-                dataset.close();
-                output_file->close();
-                delete output_file;
-                output_file=NULL;
+    // Total points to read
+    size_t total_points=size_t(seconds_to_run)*points_per_sec*channels;
+
+    // The points read are passed to the I/O thread in these buffers, of whole frames
+    size_t buffer_points=max<size_t>(max_io_points/channels,1)*channels;
+    buffer_queue<data_point_t> queue(n_buffers,buffer_points);
+
+    // The I/O thread writes the buffers in the files, and gives them back.
+    // On error it keeps giving them back (so the drain never waits) and tells the
+    // drain to stop.
+    atomic<bool> io_failed(false);
+    uint64_t io_ns=0;
+    thread io_thread([&] {
+        buffer_queue<data_point_t>::buffer b;
+        bool holding=false;
+        try {
+            output_files files(buf.capacity()/channels);
+            while ((holding=queue.pop(b))) {
+                auto t0=chrono::steady_clock::now();
+                files.write(b.data,b.n/channels);
+                io_ns+=chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-t0).count();
+                queue.release(b);
             }
-        },
+            return;
+        } catch (std::exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+        } catch (H5::Exception &e) {
+            cerr << "ERROR: " << e.getDetailMsg() << endl;
+        }
+        io_failed=true;
+        if (holding)
+            queue.release(b);
+        while (queue.pop(b))
+            queue.release(b);
+    });
+
+    // The drain: reads the ring buffer into free buffers and queues them
+    drain_stats drain;
+    size_t points_left=total_points;
+    while (points_left>0 && !stop_requested) {
+        buffer_queue<data_point_t>::buffer b=queue.get_free();
+        if (io_failed)
+            break;
+
+        // Get from the ring buffer all the points available, up to a buffer
+        size_t n_to_read= (points_left>queue.capacity())? queue.capacity() : points_left;
+
+        // Wait until there is a batch of points to read (or the max latency expires).
+        // The writer wakes us up, so no need to poll.
+        buf.wait_available(reader_id,(n_to_read<batch_size)? n_to_read : batch_size,max_latency_msec);
+
+        // (whole frames only: the writer only writes whole frames)
+        size_t lag=min<size_t>(buf.read_available(reader_id),points_left);
+        auto region=buf.acquire_read(reader_id,n_to_read);
+        size_t n=region.size()-region.size()%channels;
+        drain.read(n,lag);
+        size_t n1=min(n,region.n1);
+        copy(region.data1,region.data1+n1,b.data);
+        copy(region.data2,region.data2+(n-n1),b.data+n1);
+
+        // If we have been too slow, the writer could have overwritten the data
+        // while we were copying it: the first 'n_overwritten' points are corrupted.
+        // They are lost data (as when the reader is overrun): they are dropped,
+        // with the rest of their frame.
+        size_t n_overwritten=buf.release_read(reader_id,n);
+        if (n_overwritten) {
+            n_overwritten=min(n,(n_overwritten+channels-1)/channels*channels);
+            cerr << "Reader " << reader_id << ": WARNING " << n_overwritten << " data points overwritten while reading " << endl;
+            n-=n_overwritten;
+            copy(b.data+n_overwritten,b.data+n_overwritten+n,b.data);
+        }
+
+        b.n=n;
+        points_left-=n;
+        if (n)
+            queue.push(b);
+        else
+            queue.release(b);
+    }
+    queue.close();
+    io_thread.join();
+
+    if (!quiet) {
+        auto st=queue.stats();
+        cout << "Reader " << reader_id << ": queue depth max " << st.max_depth << " of " << queue.size()
+             << ", drain stalled " << st.stalls << " times for " << st.stall_ns/1000000 << " ms"
+             << ", I/O busy " << io_ns/1000000 << " ms" << endl;
+        cout << "Reader " << reader_id << ": " << drain.summary() << endl;
+    }
+
+    return io_failed? -1 : 0;
+}
+
+
 
-        // Continue while this condition is true
-        [&total_points] {
-            return total_points>0;
+int main(int argc, char *argv[])
+{
+    parse_args(argc,argv);
+
+    // Setup for the ring buffer, which must have been ALREDAY CREATED (this
+    // just opens it)
+    interprocess::managed_shared_memory segment(interprocess::open_only, SHARED_MEM_NAME);
+
+    // SIGUSR1 starts a new file, SIGINT and SIGTERM stop reading (the files are
+    // closed properly). The signals are blocked in all the threads and received by
+    // a thread of their own, so they never interrupt a wait or a write.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals,SIGUSR1);
+    sigaddset(&signals,SIGINT);
+    sigaddset(&signals,SIGTERM);
+    pthread_sigmask(SIG_BLOCK,&signals,NULL);
+    atomic<bool> done(false);
+    thread signal_thread([&] {
+        timespec timeout={0,100000000};
+        while (!done) {
+            int sig=sigtimedwait(&signals,NULL,&timeout);
+            if (sig==SIGUSR1)
+                rotate_requested=true;
+            else if (sig>0)
+                stop_requested=true;
         }
-    );
+    });
 
-    return 0;
+    int status=run(segment);
+    done=true;
+    signal_thread.join();
+    return status;
 }
 
 
@@ -168,9 +412,28 @@ void parse_args(int argc,char *argv[])
         ("quiet", "don't print any message")
         ("tag", po::value<string>() ,"tag for this reader")
         ("buf", po::value<string>() ,"name of the ringbuffer")
-        ("id", po::value<unsigned int>(), "reader Id")
+        ("id", po::value<unsigned int>(), "reader Id (default: the first free one)")
+        ("head", "start reading the data written from now on (default: the oldest data in the buffer)")
+        ("critical", "attach as a critical reader: depending on the overflow policy of the ring buffer, the writer waits for us or drops new data instead of overwriting ours")
         ("seconds", po::value<unsigned int>(), "how many seconds to run")
-        ("size", po::value<unsigned int>(), "file size (in data points). '0' means random size")
+        ("rate", po::value<unsigned int>(), "frames per second of the generator (default: POINTS_PER_SEC)")
+        ("size", po::value<unsigned int>(), "start a new file after this many frames (data points per channel). '0' means random size (default: 2000000, unless --roll-bytes or --roll-period)")
+        ("roll-bytes", po::value<uint64_t>(), "start a new file after this many bytes stored")
+        ("roll-period", po::value<unsigned int>(), "start a new file every this many seconds, aligned to the clock (e.g. 60: at every minute)")
+        ("batch", po::value<unsigned int>(), "how many data points to wait for before reading")
+        ("latency", po::value<unsigned int>(), "max time to wait for data (msec)")
+        ("max-io", po::value<size_t>(), "max data points per read, when more are available (default: 8 intervals of POINTS_PER_SEC)")
+        ("chunk", po::value<size_t>(), "frames per chunk of the dataset, which is also the size of the writes (default: 65536)")
+        ("shuffle", "apply the shuffle filter to the chunks")
+        ("deflate", po::value<int>(), "compress the chunks with deflate, with this level (1..9)")
+        ("threads", po::value<unsigned int>(), "threads applying the filters to the chunks (default: 2)")
+        ("buffers", po::value<unsigned int>(), "buffers queued to the I/O thread, each of one read (default: 8)")
+        ("swmr", "write the HDF5 files in SWMR mode, so they can be read while written (e.g. with h5tail)")
+        ("flush", po::value<unsigned int>(), "in SWMR mode, how often to flush the data (msec, default: 1000)")
+        ("format", po::value<string>(), "format of the files: 'hdf5' (default) or 'raw' (see data_sink.h, convert them with raw2h5)")
+        ("per-channel", "in the HDF5 files, one dataset per channel (dset_0, dset_1...) instead of a 2-D dataset [frames x channels]")
+        ("fifo", po::value<int>(), "run with this SCHED_FIFO real-time priority (1..99)")
+        ("cpus", po::value<string>(), "run on these cpus (e.g. 0,2)")
     ;
 
     po::variables_map vm;
@@ -200,12 +463,121 @@ void parse_args(int argc,char *argv[])
         exit(-1);
     }
 
-    if (vm.count("id"))
+    if (vm.count("id")) {
         reader_id= vm["id"].as<unsigned int>();
+        any_reader_id= false;
+    }
+
+    if (vm.count("head"))
+        start= swmr_start::head;
+
+    if (vm.count("critical"))
+        critical= true;
 
     if (vm.count("seconds"))
         seconds_to_run= vm["seconds"].as<unsigned int>();
 
+    if (vm.count("rate"))
+        points_per_sec= vm["rate"].as<unsigned int>();
+
+    if (vm.count("roll-bytes"))
+        roll_bytes= vm["roll-bytes"].as<uint64_t>();
+
+    if (vm.count("roll-period"))
+        roll_period_sec= vm["roll-period"].as<unsigned int>();
+
     if (vm.count("size"))
         file_size= vm["size"].as<unsigned int>();
-}
\ No newline at end of file
+    else if (roll_bytes || roll_period_sec)
+        size_rollover= false;
+
+    if (vm.count("batch"))
+        batch_size= vm["batch"].as<unsigned int>();
+
+    if (vm.count("latency"))
+        max_latency_msec= vm["latency"].as<unsigned int>();
+
+    if (vm.count("max-io")) {
+        max_io_points= vm["max-io"].as<size_t>();
+        if (max_io_points==0) {
+            cerr << "ERROR: the max I/O size must be > 0" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("chunk")) {
+        chunk_points= vm["chunk"].as<size_t>();
+        if (chunk_points==0) {
+            cerr << "ERROR: the chunk size must be > 0" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("shuffle"))
+        filters.shuffle= true;
+
+    if (vm.count("deflate")) {
+        filters.deflate= vm["deflate"].as<int>();
+        if (filters.deflate<1 || filters.deflate>9) {
+            cerr << "ERROR: the deflate level must be 1..9" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("threads"))
+        n_threads= vm["threads"].as<unsigned int>();
+
+    if (vm.count("format")) {
+        string format= vm["format"].as<string>();
+        if (format=="raw")
+            raw_output= true;
+        else if (format!="hdf5") {
+            cerr << "ERROR: unknown format " << format << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("swmr")) {
+        swmr= true;
+        if (raw_output) {
+            cerr << "ERROR: SWMR mode is only for HDF5 files" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("flush"))
+        flush_msec= vm["flush"].as<unsigned int>();
+
+    if (vm.count("per-channel")) {
+        per_channel= true;
+        if (raw_output) {
+            cerr << "ERROR: --per-channel is only for HDF5 files" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("buffers")) {
+        n_buffers= vm["buffers"].as<unsigned int>();
+        if (n_buffers<2) {
+            cerr << "ERROR: need at least 2 buffers" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("fifo")) {
+        fifo_priority= vm["fifo"].as<int>();
+        if (fifo_priority<1 || fifo_priority>99) {
+            cerr << "ERROR: the SCHED_FIFO priority must be 1..99" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("cpus")) {
+        try {
+            cpus= parse_cpu_list(vm["cpus"].as<string>());
+        } catch (std::exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            exit(-1);
+        }
+    }
+}
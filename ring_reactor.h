@@ -0,0 +1,299 @@
+#ifndef __RING_REACTOR
+#define __RING_REACTOR
+
+#include <cstdint>
+#include <cerrno>
+#include <climits>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <exception>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include <boost/asio/io_service.hpp>
+
+
+/**
+ * The work done by a ring_reactor on one ring buffer, e.g. writing its data in
+ * HDF5 files or transforming it into another ring buffer.
+ */
+class ring_handler {
+public:
+    virtual ~ring_handler() {}
+
+    /// Called when the points waited for are available (or the max latency has
+    /// expired): reads what is available. Returns false when done with the ring buffer.
+    virtual bool service()=0;
+};
+
+
+/**
+ * Counters of a ring buffer served by a ring_reactor
+ */
+struct ring_reactor_stats {
+    uint64_t services=0;   ///< calls to the handler
+    uint64_t notified=0;   ///< wake ups notified by the writer
+    uint64_t timeouts=0;   ///< wake ups for the max latency
+    uint64_t ready=0;      ///< times the data was already there after servicing
+};
+
+
+/**
+ * An event loop that serves many ring buffers in one process, on a few threads.
+ *
+ * Each ring buffer (a reader of a swmr_ringbuffer, type RING) has a handler, called
+ * when at least 'min_n' points are available or after 'latency' at most, as
+ * wait_available() does for a reader of its own. Instead of blocking a thread per
+ * ring buffer, the reactor arms the notification of the writer (see
+ * swmr_ringbuffer::arm_notify()) and one thread (the one calling run()) waits on
+ * the futex words of all the ring buffers at once, with futex_waitv(). The handlers
+ * of the ring buffers notified are posted to a boost::asio::io_service run by the
+ * worker threads. A handler is never run by two threads at once: its ring buffer is
+ * armed again only after it returns.
+ *
+ * Up to MAX_RINGS ring buffers per reactor (the limit of futex_waitv). Without
+ * futex_waitv (Linux before 5.16, other systems) the words are polled every
+ * millisecond.
+ */
+template <typename RING> class ring_reactor {
+public:
+    static const size_t MAX_RINGS=127;
+
+    ring_reactor(
+                 size_t n_threads   ///< worker threads running the handlers >.
+                ) : n_threads(n_threads)
+    {
+        if (n_threads==0)
+            throw std::invalid_argument("ring_reactor: need at least one thread");
+    }
+
+    /**
+     * Adds a ring buffer to serve, with the reader 'reader_id' (already attached).
+     * To be called before run().
+     */
+    void add(
+             RING& ring,                                 ///< the ring buffer >.
+             size_t reader_id,                           ///< the reader (attached) >.
+             size_t min_n,                               ///< points to wait for >.
+             std::chrono::milliseconds latency,          ///< max time to wait >.
+             std::shared_ptr<ring_handler> handler       ///< the work to do >.
+            )
+    {
+        if (entries.size()>=MAX_RINGS)
+            throw std::runtime_error("ring_reactor: too many ring buffers");
+        std::unique_ptr<entry> e(new entry);
+        e->ring   =&ring;
+        e->reader =reader_id;
+        e->min_n  =min_n;
+        e->latency=latency;
+        e->handler=handler;
+        entries.push_back(std::move(e));
+    }
+
+    /**
+     * Serves the ring buffers until all their handlers are done, or until stop().
+     * If a handler throws, all are stopped and the exception is thrown again here.
+     */
+    void run()
+    {
+        std::unique_ptr<boost::asio::io_service::work> work(new boost::asio::io_service::work(ios));
+        std::vector<std::thread> threads;
+        for (size_t k=0;k<n_threads;k++)
+            threads.emplace_back([this] { ios.run(); });
+
+        size_t n_active=entries.size();
+        for (auto &e : entries)
+            post(e.get());
+
+        std::vector<entry*> armed;
+        while (n_active>0 && !stopping) {
+            // Read the control word before taking the ring buffers to arm: if one is
+            // returned after this, the word has changed and the wait returns at once
+            uint32_t control_val=control.load(std::memory_order_seq_cst);
+            std::deque<entry*> returned;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                returned.swap(to_arm);
+            }
+
+            auto now=std::chrono::steady_clock::now();
+            for (entry *e : returned) {
+                if (e->done) {
+                    n_active--;
+                    continue;
+                }
+                e->armed_val=e->ring->notify_word(e->reader)->load(std::memory_order_seq_cst);
+                if (e->ring->arm_notify(e->reader,e->min_n)) {
+                    e->stats.ready++;
+                    post(e);
+                } else {
+                    e->deadline=now+e->latency;
+                    armed.push_back(e);
+                }
+            }
+            if (n_active==0)
+                break;
+
+            wait(armed,control_val);
+
+            // Service the ring buffers notified, and those whose latency has expired
+            now=std::chrono::steady_clock::now();
+            for (size_t k=0;k<armed.size();) {
+                entry *e=armed[k];
+                bool notified=e->ring->notify_word(e->reader)->load(std::memory_order_seq_cst)!=e->armed_val;
+                if (notified || now>=e->deadline) {
+                    e->ring->disarm_notify(e->reader);
+                    if (notified)
+                        e->stats.notified++;
+                    else
+                        e->stats.timeouts++;
+                    post(e);
+                    armed[k]=armed.back();
+                    armed.pop_back();
+                } else
+                    k++;
+            }
+        }
+
+        for (entry *e : armed)
+            e->ring->disarm_notify(e->reader);
+        work.reset();
+        for (auto &t : threads)
+            t.join();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    /// Makes run() return (after the handlers running have returned). Thread safe
+    void stop()
+    {
+        stopping=true;
+        ring_control();
+    }
+
+    /// The counters of the ring buffer added as 'k'-th
+    const ring_reactor_stats& stats(size_t k) const { return entries.at(k)->stats; }
+
+    /// Number of futex waits of the thread calling run()
+    uint64_t waits() const { return n_waits; }
+
+private:
+    struct entry {
+        RING*    ring=NULL;
+        size_t   reader=0;
+        size_t   min_n=0;
+        std::chrono::milliseconds latency;
+        std::shared_ptr<ring_handler> handler;
+        bool     done=false;                // the handler has returned false
+        uint32_t armed_val=0;               // the futex word when armed
+        std::chrono::steady_clock::time_point deadline;
+        ring_reactor_stats stats;
+    };
+
+    // Runs the handler on a worker thread, then gives the ring buffer back to
+    // be armed again
+    void post(entry *e)
+    {
+        ios.post([this,e] {
+            e->stats.services++;
+            bool more=false;
+            try {
+                more=e->handler->service() && !stopping;
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error)
+                        error=std::current_exception();
+                }
+                stopping=true;
+            }
+            give_back(e,!more);
+        });
+    }
+
+    void give_back(entry *e,bool done)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            e->done=done;
+            to_arm.push_back(e);
+        }
+        ring_control();
+    }
+
+    // Wakes up the thread waiting in run()
+    void ring_control()
+    {
+        control.fetch_add(1,std::memory_order_seq_cst);
+#ifdef __linux__
+        syscall(SYS_futex,reinterpret_cast<uint32_t*>(&control),FUTEX_WAKE,INT_MAX,NULL,NULL,0);
+#endif
+    }
+
+    // Waits until one of the words of the 'armed' ring buffers or the control
+    // word changes, or until the first deadline
+    void wait(const std::vector<entry*>& armed,uint32_t control_val)
+    {
+        n_waits++;
+        auto deadline=std::chrono::steady_clock::now()+std::chrono::seconds(1);
+        for (entry *e : armed)
+            deadline=std::min(deadline,e->deadline);
+
+#if defined(__linux__) && defined(SYS_futex_waitv)
+        if (!poll_mode) {
+            struct futex_waitv w[MAX_RINGS+1];
+            size_t n=0;
+            auto add_word=[&](const std::atomic<uint32_t>* word,uint32_t val) {
+                w[n].val       =val;
+                w[n].uaddr     =reinterpret_cast<uintptr_t>(word);
+                w[n].flags     =FUTEX_32;
+                w[n].__reserved=0;
+                n++;
+            };
+            add_word(&control,control_val);
+            for (entry *e : armed)
+                add_word(e->ring->notify_word(e->reader),e->armed_val);
+
+            // steady_clock is CLOCK_MONOTONIC
+            auto ns=std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+            timespec ts;
+            ts.tv_sec =ns/1000000000;
+            ts.tv_nsec=ns%1000000000;
+            if (syscall(SYS_futex_waitv,w,n,0,&ts,CLOCK_MONOTONIC)>=0 || errno!=ENOSYS)
+                return;
+            poll_mode=true;
+        }
+#endif
+        // Polling
+        while (std::chrono::steady_clock::now()<deadline &&
+               control.load(std::memory_order_seq_cst)==control_val) {
+            for (entry *e : armed)
+                if (e->ring->notify_word(e->reader)->load(std::memory_order_seq_cst)!=e->armed_val)
+                    return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    size_t n_threads;
+    boost::asio::io_service ios;
+    std::vector<std::unique_ptr<entry>> entries;
+
+    std::mutex mutex;
+    std::deque<entry*> to_arm;              // ring buffers given back by the handlers
+    std::exception_ptr error;               // the first exception of a handler
+    std::atomic<uint32_t> control{0};       // changed when one is given back
+    std::atomic<bool> stopping{false};
+    bool poll_mode=false;
+    uint64_t n_waits=0;
+};
+
+#endif
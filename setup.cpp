@@ -1,6 +1,7 @@
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
+#include <vector>
 
 
 #include <boost/program_options/options_description.hpp>
@@ -22,6 +23,11 @@ static const unsigned int SHM_OVERHEAD=512;
 
 //------------- Modified with the command line arguments --------
 bool remove_only=false;
+vector<uint64_t> buf_sizes={BUF_SIZE};             // one per buffer, or one for all
+vector<unsigned int> max_readers={MAX_READERS};     // one per buffer, or one for all
+vector<swmr_overflow> overflows={swmr_overflow::overwrite}; // one per buffer, or one for all
+swmr_memory_options memory;                         // placement of the data, for all buffers
+unsigned int channels=1;                            // data points per frame
 
 void parse_args(int argc,char *argv[]);
 
@@ -33,21 +39,54 @@ int main(int argc,char *argv[])
 
     parse_args(argc,argv);
 
-    // First, remove all (structures could be left from previous aborted execution)
+    // First, remove all (structures could be left from previous aborted execution).
+    // Opening the old segment lets the ring buffers remove their data files, if any.
+    try {
+        interprocess::managed_shared_memory old_segment(interprocess::open_only, SHARED_MEM_NAME);
+        for (auto name : buf_names)
+            shm_ringbuf::remove(name,old_segment);
+    } catch (interprocess::interprocess_exception &) {
+    }
     interprocess::shared_memory_object::remove(SHARED_MEM_NAME);
     for (auto name : buf_names)
         shm_ringbuf::remove(name);
 
 
     if (remove_only==false) {
+        const size_t n_bufs=sizeof(buf_names)/sizeof(buf_names[0]);
+
+        // Size and max readers for each buffer (if only one value was given,
+        // it is used for all buffers)
+        // The sizes are rounded to whole frames
+        auto buf_size   = [](size_t k) { return buf_sizes[k<buf_sizes.size()? k : 0]/channels*channels; };
+        auto buf_readers= [](size_t k) { return max_readers[k<max_readers.size()? k : 0]; };
+        auto buf_overflow=[](size_t k) { return overflows[k<overflows.size()? k : 0]; };
 
         // Create the shared memory segment
-        size_t n_bytes=2*shm_ringbuf::get_shm_size()+SHM_OVERHEAD;
+        size_t n_bytes=SHM_OVERHEAD;
+        for (size_t k=0;k<n_bufs;k++) {
+            if (buf_size(k)==0) {
+                cerr << "ERROR: the ring buffers must hold at least one frame (" << channels << " data points)" << endl;
+                return -1;
+            }
+            n_bytes += shm_ringbuf::get_shm_size(buf_size(k),buf_readers(k),memory);
+        }
         interprocess::managed_shared_memory segment(interprocess::create_only, SHARED_MEM_NAME, n_bytes);
 
+        // The processes find the number of channels here
+        segment.construct<uint32_t>(CHANNELS_NAME)(channels);
+
         // Create the two ring buffer areas
-        for (auto name : buf_names)
-            shm_ringbuf::construct(name,segment);
+        try {
+            for (size_t k=0;k<n_bufs;k++)
+                shm_ringbuf::construct(buf_names[k],segment,buf_size(k),buf_readers(k),buf_overflow(k),memory);
+        } catch (std::exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            for (auto name : buf_names)
+                shm_ringbuf::remove(name,segment);
+            interprocess::shared_memory_object::remove(SHARED_MEM_NAME);
+            return -1;
+        }
     }
 
     return 0;
@@ -69,6 +108,14 @@ void parse_args(int argc,char *argv[])
     desc.add_options()
         ("help", "write this help message")
         ("remove", "if specified, shared memory structure will be removed")
+        ("buf-size", po::value<vector<uint64_t>>()->multitoken(), "size of the ring buffers (data points, rounded down to whole frames): one for all, or one per buffer")
+        ("channels", po::value<unsigned int>(), "channels of the streams: the ring buffers carry frames of this many data points (default: 1)")
+        ("max-readers", po::value<vector<unsigned int>>()->multitoken(), "max number of readers: one for all, or one per buffer")
+        ("overflow", po::value<vector<string>>()->multitoken(), "when a buffer is full for a critical reader: 'overwrite', 'block' or 'drop_newest'. One for all, or one per buffer")
+        ("hugetlbfs", po::value<string>(), "store the data of the ring buffers in files in this directory (a hugetlbfs mount point, for huge pages)")
+        ("numa-node", po::value<int>(), "bind the data of the ring buffers to this NUMA node")
+        ("prefault", "allocate and map all the pages of the ring buffers in advance")
+        ("lock", "lock the data of the ring buffers in RAM (mlock) in all the processes")
     ;
 
     po::variables_map vm;
@@ -82,4 +129,51 @@ void parse_args(int argc,char *argv[])
 
     if (vm.count("remove"))
         remove_only= true;
+
+    if (vm.count("buf-size"))
+        buf_sizes= vm["buf-size"].as<vector<uint64_t>>();
+
+    if (vm.count("channels")) {
+        channels= vm["channels"].as<unsigned int>();
+        if (channels==0) {
+            cerr << "ERROR: need at least one channel" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("max-readers"))
+        max_readers= vm["max-readers"].as<vector<unsigned int>>();
+
+    if (vm.count("overflow")) {
+        overflows.clear();
+        for (auto &name : vm["overflow"].as<vector<string>>()) {
+            if (name=="overwrite")
+                overflows.push_back(swmr_overflow::overwrite);
+            else if (name=="block")
+                overflows.push_back(swmr_overflow::block);
+            else if (name=="drop_newest")
+                overflows.push_back(swmr_overflow::drop_newest);
+            else {
+                cerr << "ERROR: unknown overflow policy " << name << endl;
+                exit(-1);
+            }
+        }
+    }
+
+    if (vm.count("hugetlbfs"))
+        memory.hugetlbfs_dir= vm["hugetlbfs"].as<string>();
+
+    if (vm.count("numa-node")) {
+        memory.numa_node= vm["numa-node"].as<int>();
+        if (memory.numa_node<0) {
+            cerr << "ERROR: NUMA node must be >= 0" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("prefault"))
+        memory.prefault= true;
+
+    if (vm.count("lock"))
+        memory.lock= true;
 }
\ No newline at end of file
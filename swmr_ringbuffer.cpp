@@ -1,69 +1,371 @@
 #include <cstddef>
+#include <cstring>
+#include <algorithm>
 #include <stdexcept>
+#include <typeinfo>
+#include <sstream>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <climits>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#else
+#include <sys/param.h>
+#include <sys/mount.h>
+#endif
 #include <boost/interprocess/sync/scoped_lock.hpp>
 #include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/managed_heap_memory.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+
+namespace swmr_detail {
+
+    // Increments a futex word and wakes up all the threads (of any process: the
+    // word is in shared memory) waiting on it
+    inline void futex_bump(std::atomic<uint32_t>& word)
+    {
+        word.fetch_add(1,std::memory_order_seq_cst);
+#ifdef __linux__
+        syscall(SYS_futex,reinterpret_cast<uint32_t*>(&word),FUTEX_WAKE,INT_MAX,NULL,NULL,0);
+#endif
+    }
+}
 
 
 /*
- * This is the hard bit. Must verify all the read indices to see if we
- * are overrunning one or more readers.
+ * Writing is done in two steps, reserving the region and then publishing it
+ * (write() does both, reserve_write()/commit_write() let the caller fill
+ * the region in between).
+ * When reserving, we must announce which region we are about to overwrite:
+ * the readers check the announcement after copying (or, for zero-copy reads,
+ * when releasing), so no lock is needed here and with the 'locked' policy the
+ * mutex is taken only once per write, in commit_write().
  */
-template <typename T,size_t BUF_SIZE,size_t NUM_READERS>
-size_t swmr_ringbuffer<T,BUF_SIZE,NUM_READERS>::write(const T* data, size_t n)
+template <typename T,swmr_sync SYNC>
+swmr_region<T> swmr_ringbuffer<T,SYNC>::reserve_write(size_t n)
 {
-    // Can never write more than BUF_SIZE elements;
-    if (n>BUF_SIZE)
-        n=BUF_SIZE;
-    boost::interprocess::scoped_lock<boost::interprocess::named_mutex> lock(*mutex);
+    // Can never write more than buf_size elements;
+    if (n>buf_size)
+        n=buf_size;
+
+    // Only this process writes 'write_seq', so no need for ordering when reading it
+    uint64_t write_seq=buf->write_seq.load(std::memory_order_relaxed);
+
+    // Do not overwrite what the critical readers have not read yet
+    if (overflow!=swmr_overflow::overwrite)
+        n=make_space(write_seq,n);
+    size_t   write_index=write_seq % buf_size;
+
+    // Announce the region we are going to overwrite. The claim never goes back
+    // (a previous reservation could have been bigger than what was committed,
+    // and those elements could have been already modified by the caller).
+    // The fence keeps the writes into the region from being moved before the
+    // announcement.
+    if (buf->write_claim.load(std::memory_order_relaxed) < write_seq+n)
+        buf->write_claim.store(write_seq+n,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    reserved_n=n;
 
     // Depending of the position of the write index and the value of 'n', writing
     // 'n' elements migth require a wrap around at the buffer bottom.
-    // So we might have to do two writes into the buffer: 'n1' and 'n2' are the number
-    // of elements for the two writes (n2 is possibly zero)
-    size_t n1=BUF_SIZE - buf->write_index;
+    // So the region could be made of two parts: 'n1' and 'n2' are the number
+    // of elements of the two parts (n2 is possibly zero)
+    swmr_region<T> region;
+    region.data1=data+write_index;
+    region.n1=buf_size - write_index;
+    if (n>region.n1) {
+        region.data2=data;
+        region.n2=n-region.n1;
+    } else
+        region.n1=n;
 
-    size_t n2=0;
-    if (n>n1)
-        n2=(n-n1);
-    else
-        n1=n;
+    return region;
+}
 
 
-    // Copy the data in the buffer, in one or two moves, as required
-    memcpy(buf->data+buf->write_index,data,n1*sizeof(T));
-    if (n2)
-        memcpy(buf->data,data+n1,n2*sizeof(T));
-
-    // The new write index will be this one
-    size_t new_write_index = (buf->write_index+n) % BUF_SIZE;
-
-
-    // For each of the readers, if it has been too slow to read,
-    // we move forward its read pointer (data is lost for that reader).
-    for (auto &rd_desc : buf->reader_descr) {
-
-        // If we have overrun the read index, update it to skip all the 'lost'
-        // (overwritten) data.
-        // This depends on the position of the write inded BEFORE and AFTER
-        // this write (write_index, new_write_index), if we had a wrap around (n2>0)
-        // and of course the position of the read index.
-        // Note that (write_index==rd_desc.index) can mean 'buffer full' or 'buffer
-        // empty' depending if 'available' is 0 or not.
-        if (
-             ( (buf->write_index>rd_desc.index)  && (n2>0) && (new_write_index>rd_desc.index) ) ||
-             ( (buf->write_index<rd_desc.index)  && (new_write_index>rd_desc.index) ) ||
-             ( (buf->write_index==rd_desc.index) && (rd_desc.available>0) )
-           ) {
-            rd_desc.index= new_write_index;
+/*
+ * This is the hard bit. With the 'locked' policy must verify all the read
+ * sequence numbers to see if we are overrunning one or more readers.
+ * With the 'lock_free' policy the readers check that themselves.
+ */
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::commit_write(size_t n)
+{
+    // Only what has been announced by reserve_write() can be published
+    if (n>reserved_n)
+        throw std::invalid_argument("swmr_ringbuffer::commit_write: committing more than reserved");
+    reserved_n=0;
+
+    uint64_t new_write_seq=buf->write_seq.load(std::memory_order_relaxed)+n;
+
+    {
+        timed_lock lock(sync_mutex(),buf->stats.lock_wait_ns,buf->stats.lock_hold_ns);
+
+        // For each of the readers, if it has been too slow to read,
+        // we move forward its read pointer (data is lost for that reader).
+        // A reader is overrun if after this write it would have more than
+        // buf_size elements to read: it then skips all the 'lost' (overwritten) data.
+        if (SYNC==swmr_sync::locked) {
+            for_each_active([&](reader_descr& rd_desc) {
+                uint64_t read_seq=rd_desc.seq.load(std::memory_order_relaxed);
+                if (new_write_seq - read_seq > buf_size) {
+                    rd_desc.seq.store(new_write_seq-buf_size,std::memory_order_relaxed);
+                    count(rd_desc.stats.lost,new_write_seq-buf_size-read_seq);
+                    count(rd_desc.stats.overruns,1);
+                    count(buf->stats.overruns,1);
+                }
+            });
+        }
+
+        // Publish the new data. This must be ordered with the check of 'wake_seq' below
+        // (and the reader does the opposite), so that either the reader sees the new
+        // data or we see that the reader is waiting.
+        buf->write_seq.store(new_write_seq,std::memory_order_seq_cst);
+    }
+    count(buf->stats.written,n);
+    count(buf->stats.writes,1);
+
+    // Wake up the readers that are waiting for data, if enough has been written.
+    // This is done after releasing the mutex. Resetting 'wake_seq' makes sure we
+    // post only once for each wait. The readers served by an event loop are
+    // notified on their futex word instead (see arm_notify()).
+    for_each_active([&](reader_descr& rd_desc) {
+        uint64_t wake_seq=rd_desc.wake_seq.load(std::memory_order_seq_cst);
+        if (wake_seq!=0 && new_write_seq>=wake_seq &&
+            rd_desc.wake_seq.compare_exchange_strong(wake_seq,0,std::memory_order_seq_cst)) {
+            if (rd_desc.notify.load(std::memory_order_relaxed))
+                swmr_detail::futex_bump(rd_desc.notify_word);
+            else
+                rd_desc.wake_sem.post();
+        }
+    });
+}
+
+/*
+ * The space left is given by the slowest critical reader. To wait for it, the
+ * writer sets the sequence number that reader must reach in its 'space_seq' and
+ * then checks again (the reader does the opposite in publish_seq()), so the
+ * wake up cannot be lost. The wait has a timeout to detect a critical reader
+ * whose process has died: it is not treated as critical any more.
+ */
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::make_space(uint64_t write_seq,size_t n)
+{
+    const unsigned long DEAD_READER_CHECK_MSEC=100;
+    std::chrono::steady_clock::time_point wait_start;
+    bool waited=false;
+
+    while (true) {
+        // Find the slowest critical reader
+        size_t   slowest=num_readers;
+        uint64_t min_seq=write_seq;
+        for (size_t w=0;w<active_words;w++) {
+            uint64_t bits=active[w].load(std::memory_order_seq_cst) & critical[w].load(std::memory_order_seq_cst);
+            while (bits) {
+                size_t   k=w*64+__builtin_ctzll(bits);
+                uint64_t seq=readers[k].seq.load(std::memory_order_seq_cst);
+                if (seq<min_seq) {
+                    min_seq=seq;
+                    slowest=k;
+                }
+                bits &= bits-1;
+            }
+        }
+        if (write_seq-min_seq>buf_size)
+            min_seq=write_seq-buf_size;
+        size_t space=buf_size-(write_seq-min_seq);
+
+        if (space>=n || overflow==swmr_overflow::drop_newest) {
+            if (space<n) {
+                count(buf->stats.dropped,n-space);
+                n=space;
+            }
+            break;
+        }
+
+        // Wait for the slowest reader to make enough space
+        if (!waited) {
+            wait_start=std::chrono::steady_clock::now();
+            waited=true;
+        }
+        auto &rd=readers[slowest];
+        uint64_t need=write_seq+n-buf_size;
+        rd.space_seq.store(need,std::memory_order_seq_cst);
+        if (rd.seq.load(std::memory_order_seq_cst)>=need)
+            continue;   // A post could be left over: it just makes us check once more
+
+        boost::posix_time::ptime deadline=boost::posix_time::microsec_clock::universal_time()+
+                                          boost::posix_time::milliseconds(DEAD_READER_CHECK_MSEC);
+        if (!buf->writer_wait.sem.timed_wait(deadline)) {
+            uint32_t pid=rd.pid.load(std::memory_order_relaxed);
+            if (pid!=0 && kill(pid,0)!=0 && errno==ESRCH)
+                critical[slowest/64].fetch_and(~(1ULL<<(slowest%64)),std::memory_order_seq_cst);
+        }
+    }
+
+    if (waited)
+        count(buf->stats.blocked_ns,std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        std::chrono::steady_clock::now()-wait_start).count());
+    return n;
+}
+
+/*
+ * With a blocking policy the store must be ordered with the check of 'space_seq'
+ * (the writer does the opposite), so that either the writer sees the new read
+ * sequence number or we see that it is waiting.
+ */
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::publish_seq(reader_descr& rd,uint64_t seq,std::memory_order order)
+{
+    if (overflow!=swmr_overflow::block) {
+        rd.seq.store(seq,order);
+        return;
+    }
+    rd.seq.store(seq,std::memory_order_seq_cst);
+    uint64_t need=rd.space_seq.load(std::memory_order_seq_cst);
+    if (need!=0 && seq>=need && rd.space_seq.compare_exchange_strong(need,0,std::memory_order_seq_cst))
+        buf->writer_wait.sem.post();
+}
+
+/*
+ * Scans the mask one 64-bit word at a time, so a write costs nothing for the
+ * readers that are not attached.
+ */
+template <typename T,swmr_sync SYNC>
+template <typename F>
+void swmr_ringbuffer<T,SYNC>::for_each_active(F f)
+{
+    for (size_t w=0;w<active_words;w++) {
+        uint64_t bits=active[w].load(std::memory_order_seq_cst);
+        while (bits) {
+            f(readers[w*64+__builtin_ctzll(bits)]);
+            bits &= bits-1;
+        }
+    }
+}
+
+/*
+ * The slot is taken with a compare-and-swap of the owner PID, so two processes
+ * can never get the same one. A slot whose owner does not exist any more
+ * (kill() fails with ESRCH) is taken over.
+ */
+template <typename T,swmr_sync SYNC>
+bool swmr_ringbuffer<T,SYNC>::claim_reader(size_t k,uint32_t pid)
+{
+    uint32_t owner=0;
+    if (readers[k].pid.compare_exchange_strong(owner,pid))
+        return true;
+    if (owner==pid || kill(owner,0)==0 || errno!=ESRCH)
+        return false;
+    return readers[k].pid.compare_exchange_strong(owner,pid);
+}
+
+/*
+ * With the 'locked' policy this is done holding the mutex, so the writer
+ * sees the new read position together with the active bit. A wake up left
+ * pending by the previous owner is cancelled.
+ */
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::activate_reader(size_t k,swmr_start start,bool is_critical)
+{
+    auto &rd=readers[k]; // Just for shorthand
+    timed_lock lock(sync_mutex(),rd.stats.lock_wait_ns,rd.stats.lock_hold_ns);
+
+    uint64_t write_seq  =buf->write_seq.load(std::memory_order_acquire);
+    uint64_t write_claim=buf->write_claim.load(std::memory_order_relaxed);
+    uint64_t read_seq   =write_seq;
+    if (start==swmr_start::oldest)
+        read_seq=(write_claim>buf_size)? write_claim-buf_size : 0;
+
+    rd.wake_seq.store(0,std::memory_order_relaxed);
+    rd.notify.store(0,std::memory_order_relaxed);
+    rd.space_seq.store(0,std::memory_order_relaxed);
+    rd.seq.store(read_seq,std::memory_order_relaxed);
+    if (is_critical)
+        critical[k/64].fetch_or(1ULL<<(k%64),std::memory_order_seq_cst);
+    else
+        critical[k/64].fetch_and(~(1ULL<<(k%64)),std::memory_order_seq_cst);
+    active[k/64].fetch_or(1ULL<<(k%64),std::memory_order_seq_cst);
+    attached[k]=true;
+    acquired_seq[k]=read_seq;
+    acquired_n[k]  =0;
+}
+
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::attach_reader(swmr_start start,bool is_critical)
+{
+    uint32_t pid=getpid();
+    for (size_t k=0;k<num_readers;k++) {
+        uint32_t owner=0;
+        if (readers[k].pid.compare_exchange_strong(owner,pid)) {
+            activate_reader(k,start,is_critical);
+            return k;
+        }
+    }
+    // No free reader: look for dead ones
+    for (size_t k=0;k<num_readers;k++) {
+        if (claim_reader(k,pid)) {
+            activate_reader(k,start,is_critical);
+            return k;
         }
+    }
+    throw std::runtime_error("swmr_ringbuffer::attach_reader: all the readers are in use");
+}
 
-        // Increment the 'available' counter, clipping at BUF_SIZE
-        rd_desc.available += n;
-        if (rd_desc.available>BUF_SIZE)
-            rd_desc.available=BUF_SIZE;
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::attach_reader(size_t reader,swmr_start start,bool is_critical)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in swmr_ringbuffer::attach_reader");
+    if (attached[reader] || !claim_reader(reader,getpid()))
+        throw std::runtime_error("swmr_ringbuffer::attach_reader: reader "+std::to_string(reader)+" is in use");
+    activate_reader(reader,start,is_critical);
+}
+
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::detach_reader(size_t reader)
+{
+    if (reader>=num_readers || !attached[reader])
+        throw std::invalid_argument("swmr_ringbuffer::detach_reader: reader not attached");
+
+    auto &rd=readers[reader]; // Just for shorthand
+    {
+        timed_lock lock(sync_mutex(),rd.stats.lock_wait_ns,rd.stats.lock_hold_ns);
+        active[reader/64].fetch_and(~(1ULL<<(reader%64)),std::memory_order_seq_cst);
+        critical[reader/64].fetch_and(~(1ULL<<(reader%64)),std::memory_order_seq_cst);
     }
 
-    buf->write_index = new_write_index;
+    // The writer could be waiting for this reader
+    uint64_t need=rd.space_seq.load(std::memory_order_seq_cst);
+    if (need!=0 && rd.space_seq.compare_exchange_strong(need,0,std::memory_order_seq_cst))
+        buf->writer_wait.sem.post();
+    rd.wake_seq.store(0,std::memory_order_relaxed);
+    rd.pid.store(0,std::memory_order_release);
+    attached[reader]=false;
+}
+
+
+/*
+ * Reserve, copy and publish
+ */
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::write(const T* data, size_t n)
+{
+    auto region=reserve_write(n);
+
+    // Copy the data in the buffer, in one or two moves, as required
+    memcpy(region.data1,data,region.n1*sizeof(T));
+    if (region.n2)
+        memcpy(region.data2,data+region.n1,region.n2*sizeof(T));
+
+    n=region.size();
+    commit_write(n);
     return n;
 }
 
@@ -71,81 +373,593 @@ size_t swmr_ringbuffer<T,BUF_SIZE,NUM_READERS>::write(const T* data, size_t n)
 /*
  * No need to use the mutex, as it is already done inside
  */
-template <typename T,size_t BUF_SIZE,size_t NUM_READERS>
-void swmr_ringbuffer<T,BUF_SIZE,NUM_READERS>::write(const T& data) {
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::write(const T& data) {
     write(&data,1);
 }
 
+template <typename T,swmr_sync SYNC>
+swmr_ringbuffer<T,SYNC>::producer::producer(swmr_ringbuffer& ring,size_t batch_size,unsigned long max_latency_usec)
+    : ring(ring), max_latency(std::chrono::microseconds(max_latency_usec))
+{
+    if (batch_size==0)
+        throw std::invalid_argument("swmr_ringbuffer::producer: batch size must be > 0");
+    if (batch_size>ring.capacity())
+        batch_size=ring.capacity();
+    batch.resize(batch_size);
+}
+
+template <typename T,swmr_sync SYNC>
+swmr_ringbuffer<T,SYNC>::producer::~producer()
+{
+    flush();
+}
+
+/*
+ * With swmr_overflow::drop_newest what does not fit is dropped (and counted
+ * as dropped by the ring buffer), as for a normal write().
+ */
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::producer::flush()
+{
+    if (n_pending==0)
+        return 0;
+    size_t n=ring.write(batch.data(),n_pending);
+    n_pending=0;
+    return n;
+}
+
+template <typename T,swmr_sync SYNC>
+bool swmr_ringbuffer<T,SYNC>::producer::flush_if_due()
+{
+    if (n_pending==0 || std::chrono::steady_clock::now()<deadline)
+        return false;
+    flush();
+    return true;
+}
+
+
 /*
  * Reading is easier because we cannot overrun.
  * We need just to keep track of the wrap around at the bottom of the buffer.
+ * We must also check, after copying, that the writer has not overwritten what
+ * we were copying (the writer fills the reserved regions without the mutex,
+ * so this is needed also with the 'locked' policy).
  */
-template <typename T,size_t BUF_SIZE,size_t NUM_READERS>
-size_t swmr_ringbuffer<T,BUF_SIZE,NUM_READERS>::read(size_t reader,T* read_buf,size_t n)
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::read(size_t reader,T* read_buf,size_t n)
 {
-    if (reader>=NUM_READERS)
+    if (reader>=num_readers)
         throw std::invalid_argument("invalid reader_id in swmr_ringbuffer::read");
 
-    boost::interprocess::scoped_lock<boost::interprocess::named_mutex> lock(*mutex);
+    auto &rd=readers[reader]; // Just for shorthand
+    timed_lock lock(sync_mutex(),rd.stats.lock_wait_ns,rd.stats.lock_hold_ns);
 
-    auto &rd=buf->reader_descr[reader]; // Just for shorthand
+    uint64_t first_seq=rd.seq.load(std::memory_order_relaxed);
+    uint64_t read_seq =first_seq;
+    size_t   n_read;
 
-    // cannot read more than what's available
-    if (n>rd.available)
-        n=rd.available;
+    while (true) {
+        uint64_t write_seq  =buf->write_seq.load(std::memory_order_acquire);
+        if (read_seq==first_seq)
+            count_max(rd.stats.max_lag,std::min<uint64_t>(write_seq-read_seq,buf_size));
+        uint64_t write_claim=buf->write_claim.load(std::memory_order_relaxed);
 
-    // Depending of the position of the read index and the value of 'n', reading
-    // 'n' elements migth require a wrap around at the buffer bottom.
-    // So we might have to do two read from the buffer: 'n1' and 'n2' are the number
-    // of elements for the two reads.
-    size_t n1=BUF_SIZE-rd.index; // how many to read to the end of the buffer
-    size_t n2=0;                 // if we wrap around when reading will be non zero
-    if (n>n1)
-        n2=n-n1; // wrap around when reading: how many to read from start of buf
-    else
-        n1=n;
+        // If we have been overrun (with 'lock_free') or the writer has reserved
+        // a region that overlaps with what we would read, skip the lost data
+        if (write_claim-read_seq > buf_size)
+            read_seq=write_claim-buf_size;
 
-    // Copy the data from the buffer in one or two moves, as required
-    memcpy(read_buf,buf->data+rd.index,n1*sizeof(T));
-    if (n2)
-        memcpy(read_buf+n1,buf->data,n2*sizeof(T));
+        // cannot read more than what's available
+        n_read=n;
+        if (n_read>write_seq-read_seq)
+            n_read=write_seq-read_seq;
 
-    // Update read index and element counter
-    rd.index = (rd.index+n) % BUF_SIZE;
-    rd.available -= n;
+        // Depending of the position of the read index and the value of 'n', reading
+        // 'n' elements migth require a wrap around at the buffer bottom.
+        // So we might have to do two read from the buffer: 'n1' and 'n2' are the number
+        // of elements for the two reads.
+        size_t read_index=read_seq % buf_size;
+        size_t n1=buf_size-read_index; // how many to read to the end of the buffer
+        size_t n2=0;                   // if we wrap around when reading will be non zero
+        if (n_read>n1)
+            n2=n_read-n1; // wrap around when reading: how many to read from start of buf
+        else
+            n1=n_read;
 
-    return n;
+        // Copy the data from the buffer in one or two moves, as required
+        memcpy(read_buf,data+read_index,n1*sizeof(T));
+        if (n2)
+            memcpy(read_buf+n1,data,n2*sizeof(T));
+
+        // The writer overwrites the elements up to 'write_claim'-buf_size. If that
+        // is beyond our read position, what we copied could be corrupted: the
+        // oldest data is lost, skip it and try again.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        write_claim=buf->write_claim.load(std::memory_order_relaxed);
+        if (write_claim <= read_seq+buf_size)
+            break;
+        read_seq=write_claim-buf_size;
+    }
+
+    // Update read sequence number
+    publish_seq(rd,read_seq+n_read,std::memory_order_release);
+
+    count(rd.stats.read,n_read);
+    if (read_seq!=first_seq) {
+        count(rd.stats.lost,read_seq-first_seq);
+        count(rd.stats.overruns,1);
+    }
+
+    return n_read;
+}
+
+/*
+ * The reader registers the sequence number it wants to be woken up at,
+ * then checks if the data is already there before going to sleep on the
+ * semaphore. The writer checks the registration after publishing, so
+ * either we see the data or the writer sees we are waiting and posts:
+ * the wake up cannot be lost. A post left over from a previous wait just
+ * makes us check again.
+ */
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::wait_available(size_t reader,size_t min_n,unsigned long timeout_msec)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in swmr_ringbuffer::wait_available");
+
+    // Can never have more than buf_size elements to read
+    if (min_n>buf_size)
+        min_n=buf_size;
+
+    size_t available=read_available(reader);
+    if (available>=min_n)
+        return available;
+
+    auto &rd=readers[reader]; // Just for shorthand
+    boost::posix_time::ptime deadline=boost::posix_time::microsec_clock::universal_time()+
+                                      boost::posix_time::milliseconds(timeout_msec);
+    rd.notify.store(0,std::memory_order_relaxed);
+
+    while (true) {
+        // If we are overrun the read sequence number moves forward, so this is
+        // recomputed at every iteration
+        rd.wake_seq.store(rd.seq.load(std::memory_order_relaxed)+min_n,std::memory_order_seq_cst);
+
+        available=read_available(reader);
+        if (available>=min_n)
+            break;
+        if (!rd.wake_sem.timed_wait(deadline)) {
+            available=read_available(reader);
+            break;
+        }
+    }
+    rd.wake_seq.store(0,std::memory_order_seq_cst);
+
+    return available;
 }
 
 /*
- * No need to wrap with the mutex, as reading the counter is atomic
+ * As wait_available(), but the writer increments the futex word instead of
+ * posting the semaphore. 'notify' is set before 'wake_seq' (the writer reads
+ * it after resetting 'wake_seq').
  */
-template <typename T,size_t BUF_SIZE,size_t NUM_READERS>
-size_t swmr_ringbuffer<T,BUF_SIZE,NUM_READERS>::read_available(size_t reader) {
-    if (reader>=NUM_READERS)
+template <typename T,swmr_sync SYNC>
+bool swmr_ringbuffer<T,SYNC>::arm_notify(size_t reader,size_t min_n)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in swmr_ringbuffer::arm_notify");
+
+    // Can never have more than buf_size elements to read
+    if (min_n>buf_size)
+        min_n=buf_size;
+    if (min_n==0)
+        return true;
+
+    auto &rd=readers[reader]; // Just for shorthand
+    rd.notify.store(1,std::memory_order_relaxed);
+    rd.wake_seq.store(rd.seq.load(std::memory_order_relaxed)+min_n,std::memory_order_seq_cst);
+    if (read_available(reader)>=min_n) {
+        rd.wake_seq.store(0,std::memory_order_seq_cst);
+        return true;
+    }
+    return false;
+}
+
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::disarm_notify(size_t reader)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in swmr_ringbuffer::disarm_notify");
+    readers[reader].wake_seq.store(0,std::memory_order_seq_cst);
+}
+
+template <typename T,swmr_sync SYNC>
+const std::atomic<uint32_t>* swmr_ringbuffer<T,SYNC>::notify_word(size_t reader) const
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in swmr_ringbuffer::notify_word");
+    return &readers[reader].notify_word;
+}
+
+/*
+ * Wait and then do a normal read
+ */
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::read_wait(size_t reader,T* read_buf,size_t min_n,size_t max_n,unsigned long timeout_msec)
+{
+    wait_available(reader,min_n,timeout_msec);
+    return read(reader,read_buf,max_n);
+}
+
+/*
+ * Same as read(), but without copying. The read sequence number is only moved
+ * forward to skip data that is lost or about to be overwritten.
+ */
+template <typename T,swmr_sync SYNC>
+swmr_region<const T> swmr_ringbuffer<T,SYNC>::acquire_read(size_t reader,size_t max_n)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in swmr_ringbuffer::acquire_read");
+
+    auto &rd=readers[reader]; // Just for shorthand
+    timed_lock lock(sync_mutex(),rd.stats.lock_wait_ns,rd.stats.lock_hold_ns);
+
+    uint64_t read_seq   =rd.seq.load(std::memory_order_relaxed);
+    uint64_t write_seq  =buf->write_seq.load(std::memory_order_acquire);
+    uint64_t write_claim=buf->write_claim.load(std::memory_order_relaxed);
+    count_max(rd.stats.max_lag,std::min<uint64_t>(write_seq-read_seq,buf_size));
+
+    // Skip what has been lost or is being overwritten right now
+    if (write_claim-read_seq > buf_size) {
+        count(rd.stats.lost,write_claim-buf_size-read_seq);
+        count(rd.stats.overruns,1);
+        read_seq=write_claim-buf_size;
+    }
+    publish_seq(rd,read_seq,std::memory_order_release);
+
+    size_t n=max_n;
+    if (n>write_seq-read_seq)
+        n=write_seq-read_seq;
+
+    acquired_seq[reader]=read_seq;
+    acquired_n[reader]  =n;
+
+    // As in read(), the region might wrap around at the buffer bottom
+    swmr_region<const T> region;
+    size_t read_index=read_seq % buf_size;
+    region.data1=data+read_index;
+    region.n1=buf_size-read_index;
+    if (n>region.n1) {
+        region.data2=data;
+        region.n2=n-region.n1;
+    } else
+        region.n1=n;
+
+    return region;
+}
+
+/*
+ * The writer announces with 'write_claim' what it is overwriting, so we
+ * can tell if the region has been (partly) overwritten while it was held.
+ */
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::release_read(size_t reader,size_t n)
+{
+    if (reader>=num_readers)
+        throw std::invalid_argument("invalid reader_id in swmr_ringbuffer::release_read");
+    if (n>acquired_n[reader])
+        throw std::invalid_argument("swmr_ringbuffer::release_read: releasing more than acquired");
+
+    auto &rd=readers[reader]; // Just for shorthand
+    timed_lock lock(sync_mutex(),rd.stats.lock_wait_ns,rd.stats.lock_hold_ns);
+
+    uint64_t start=acquired_seq[reader];
+    uint64_t end  =start+n;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t write_claim=buf->write_claim.load(std::memory_order_relaxed);
+
+    // The writer has overwritten everything before 'write_claim'-buf_size
+    size_t overwritten=0;
+    if (write_claim > start+buf_size)
+        overwritten= (write_claim-buf_size < end)? write_claim-buf_size-start : n;
+
+    // With the 'locked' policy the writer could have already moved the read
+    // sequence number past the region (and counted as lost what it skipped)
+    uint64_t read_seq=rd.seq.load(std::memory_order_relaxed);
+    if (read_seq < end)
+        publish_seq(rd,end,std::memory_order_release);
+
+    size_t counted=(read_seq>start)? std::min(read_seq,end)-start : 0;
+    count(rd.stats.read,n-overwritten);
+    if (overwritten>counted) {
+        count(rd.stats.lost,overwritten-counted);
+        count(rd.stats.overruns,1);
+    }
+    acquired_seq[reader]=end;
+    acquired_n[reader] -= n;
+
+    return overwritten;
+}
+
+/*
+ * No need to wrap with the mutex, as reading the counters is atomic.
+ * The writer might update the counters between the two reads, so clip
+ * at buf_size.
+ */
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::read_available(size_t reader) {
+    if (reader>=num_readers)
         throw std::invalid_argument("invalid reader_id in swmr_ringbuffer::read_available");
-    return buf->reader_descr[reader].available;
+    uint64_t read_seq  = readers[reader].seq.load(std::memory_order_acquire);
+    uint64_t write_seq = buf->write_seq.load(std::memory_order_seq_cst);
+    uint64_t available = write_seq-read_seq;
+    return (available>buf_size)? buf_size : available;
+}
+
+template <typename T,swmr_sync SYNC>
+swmr_stats swmr_ringbuffer<T,SYNC>::get_stats(const shm_buf *buf,const reader_descr *readers,const std::atomic<uint64_t> *active)
+{
+    swmr_stats st;
+    st.buf_size    =buf->buf_size;
+    st.write_seq   =buf->write_seq.load(std::memory_order_relaxed);
+    st.written     =buf->stats.written.load(std::memory_order_relaxed);
+    st.writes      =buf->stats.writes.load(std::memory_order_relaxed);
+    st.overruns    =buf->stats.overruns.load(std::memory_order_relaxed);
+    st.dropped     =buf->stats.dropped.load(std::memory_order_relaxed);
+    st.blocked_ns  =buf->stats.blocked_ns.load(std::memory_order_relaxed);
+    st.lock_wait_ns=buf->stats.lock_wait_ns.load(std::memory_order_relaxed);
+    st.lock_hold_ns=buf->stats.lock_hold_ns.load(std::memory_order_relaxed);
+
+    st.readers.resize(buf->max_readers);
+    for (size_t k=0;k<st.readers.size();k++) {
+        const reader_descr &rd=readers[k];
+        swmr_reader_stats  &rs=st.readers[k];
+        rs.active      =(active[k/64].load(std::memory_order_relaxed)>>(k%64)) & 1;
+        rs.critical    =(active[(buf->max_readers+63)/64+k/64].load(std::memory_order_relaxed)>>(k%64)) & 1;
+        rs.pid         =rd.pid.load(std::memory_order_relaxed);
+        rs.seq         =rd.seq.load(std::memory_order_relaxed);
+        rs.lag         =std::min<uint64_t>(st.write_seq-rs.seq,st.buf_size);
+        rs.read        =rd.stats.read.load(std::memory_order_relaxed);
+        rs.lost        =rd.stats.lost.load(std::memory_order_relaxed);
+        rs.overruns    =rd.stats.overruns.load(std::memory_order_relaxed);
+        rs.max_lag     =rd.stats.max_lag.load(std::memory_order_relaxed);
+        rs.lock_wait_ns=rd.stats.lock_wait_ns.load(std::memory_order_relaxed);
+        rs.lock_hold_ns=rd.stats.lock_hold_ns.load(std::memory_order_relaxed);
+    }
+    return st;
+}
+
+/*
+ * Uses find_no_lock(), so that the segment can be mapped read-only
+ */
+template <typename T,swmr_sync SYNC>
+template <typename SEGMENT>
+swmr_stats swmr_ringbuffer<T,SYNC>::stats(const char * name,SEGMENT& segment)
+{
+    char *mem=segment.template find_no_lock<char>( name ).first;
+    if (mem==NULL)
+        throw std::runtime_error(std::string("swmr_ringbuffer: cannot find ")+name);
+    mem+=(CACHE_LINE - reinterpret_cast<uintptr_t>(mem)%CACHE_LINE)%CACHE_LINE;
+
+    const shm_buf *hdr=reinterpret_cast<const shm_buf*>(mem);
+    if (hdr->magic!=SHM_MAGIC || hdr->version!=SHM_VERSION)
+        throw std::runtime_error(std::string("swmr_ringbuffer: ")+name+" is not a ring buffer or has a different version");
+    return get_stats(hdr,reinterpret_cast<const reader_descr*>(mem+readers_offset()),
+                     reinterpret_cast<const std::atomic<uint64_t>*>(mem+active_offset(hdr->max_readers)));
+}
+
+template <typename T,swmr_sync SYNC>
+swmr_ringbuffer<T,SYNC>::timed_lock::timed_lock(ring_mutex *mutex,
+                                                std::atomic<uint64_t>& wait_ns,std::atomic<uint64_t>& hold_ns)
+    : mutex(mutex), hold_ns(hold_ns)
+{
+    if (mutex==NULL)
+        return;
+    auto start=std::chrono::steady_clock::now();
+    mutex->lock();
+    locked_at=std::chrono::steady_clock::now();
+    count(wait_ns,std::chrono::duration_cast<std::chrono::nanoseconds>(locked_at-start).count());
+}
+
+template <typename T,swmr_sync SYNC>
+swmr_ringbuffer<T,SYNC>::timed_lock::~timed_lock()
+{
+    if (mutex==NULL)
+        return;
+    auto unlocked_at=std::chrono::steady_clock::now();
+    mutex->unlock();
+    count(hold_ns,std::chrono::duration_cast<std::chrono::nanoseconds>(unlocked_at-locked_at).count());
+}
+
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::readers_offset()
+{
+    return (sizeof(shm_buf)+CACHE_LINE-1)/CACHE_LINE*CACHE_LINE;
+}
+
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::active_offset(size_t max_readers)
+{
+    return readers_offset()+max_readers*sizeof(reader_descr);
 }
 
-template <typename T,size_t BUF_SIZE,size_t NUM_READERS>
-size_t swmr_ringbuffer<T,BUF_SIZE,NUM_READERS>::get_shm_size()
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::data_offset(size_t max_readers)
 {
-    return sizeof *buf;
+    size_t offset=active_offset(max_readers)+(max_readers+63)/64*2*sizeof(std::atomic<uint64_t>);
+    return (offset+CACHE_LINE-1)/CACHE_LINE*CACHE_LINE;
 }
 
-template <typename T,size_t BUF_SIZE,size_t NUM_READERS>
-bool swmr_ringbuffer<T,BUF_SIZE,NUM_READERS>::construct(
+/*
+ * Extra CACHE_LINE bytes, so that the structure can be aligned in the segment
+ */
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::get_shm_size(uint64_t buf_size,size_t max_readers,const swmr_memory_options& memory)
+{
+    if (!memory.hugetlbfs_dir.empty())
+        return data_offset(max_readers)+CACHE_LINE;
+    return data_offset(max_readers)+buf_size*sizeof(T)+CACHE_LINE;
+}
+
+template <typename T,swmr_sync SYNC>
+size_t swmr_ringbuffer<T,SYNC>::data_file_size(uint64_t buf_size,size_t page_size)
+{
+    return (buf_size*sizeof(T)+page_size-1)/page_size*page_size;
+}
+
+namespace swmr_detail {
+
+    // statfs() f_type of a hugetlbfs file system
+    static const unsigned long HUGETLBFS_MAGIC=0x958458f6;
+
+    // Binds the whole pages in [addr,addr+len) to 'numa_node' (moving them there if
+    // they are already allocated). For a shared mapping the policy is kept by the
+    // memory object, so it applies to all the processes mapping it.
+    inline void bind_numa_node(void *addr,size_t len,size_t page_size,int numa_node)
+    {
+#ifdef __linux__
+        const int MPOL_BIND_=2;
+        const unsigned MPOL_MF_MOVE_=1<<1;
+        const size_t BITS=8*sizeof(unsigned long);
+
+        uintptr_t start=(reinterpret_cast<uintptr_t>(addr)+page_size-1)/page_size*page_size;
+        uintptr_t end  =(reinterpret_cast<uintptr_t>(addr)+len)/page_size*page_size;
+        if (end<=start)
+            return;
+
+        std::vector<unsigned long> nodemask(numa_node/BITS+1,0);
+        nodemask[numa_node/BITS] |= 1UL<<(numa_node%BITS);
+        if (syscall(SYS_mbind,start,end-start,MPOL_BIND_,nodemask.data(),nodemask.size()*BITS+1,MPOL_MF_MOVE_)!=0)
+            throw std::runtime_error(std::string("swmr_ringbuffer: cannot bind memory to NUMA node: ")+strerror(errno));
+#else
+        throw std::runtime_error("swmr_ringbuffer: NUMA binding is only supported on Linux");
+#endif
+    }
+
+    // Touches one byte per page: writing allocates the pages (done once, when
+    // creating), reading maps them in the calling process
+    inline void prefault(void *addr,size_t len,size_t page_size,bool write)
+    {
+        volatile char *p=static_cast<char*>(addr);
+        for (size_t k=0;k<len;k+=page_size) {
+            if (write)
+                p[k]=0;
+            else
+                (void)p[k];
+        }
+    }
+}
+
+/*
+ * The structure is allocated in the segment as an array of bytes (with 'name'), and
+ * aligned to CACHE_LINE inside it. The segment is always mapped at a page boundary,
+ * so the alignment is the same for all the processes.
+ * The data is either in the segment, after the readers descriptors, or in a file
+ * of its own (in a hugetlbfs directory, for huge pages).
+ */
+template <typename T,swmr_sync SYNC>
+template <typename SEGMENT>
+bool swmr_ringbuffer<T,SYNC>::construct(
                            const char * name,
-                           boost::interprocess::managed_shared_memory& segment
+                           SEGMENT& segment,
+                           uint64_t buf_size,
+                           size_t max_readers,
+                           swmr_overflow overflow,
+                           const swmr_memory_options& memory
                          )
 {
-    segment.construct<shm_buf>( name )();
-    boost::interprocess::named_mutex mutex(boost::interprocess::create_only,name);
+    if (buf_size==0)
+        throw std::invalid_argument("swmr_ringbuffer::construct: buffer size must be > 0");
+    if (max_readers==0 || max_readers>UINT32_MAX)
+        throw std::invalid_argument("swmr_ringbuffer::construct: max number of readers must be > 0 and fit in 32 bits");
+
+    // Where the data will be
+    size_t page_size=sysconf(_SC_PAGESIZE);
+    bool huge_pages=false;
+    std::string data_file;
+    if (!memory.hugetlbfs_dir.empty()) {
+        struct statfs fs;
+        if (statfs(memory.hugetlbfs_dir.c_str(),&fs)!=0)
+            throw std::invalid_argument("swmr_ringbuffer::construct: cannot access "+memory.hugetlbfs_dir+": "+strerror(errno));
+        page_size =fs.f_bsize;
+        huge_pages=(static_cast<unsigned long>(fs.f_type)==swmr_detail::HUGETLBFS_MAGIC);
+        data_file =memory.hugetlbfs_dir+"/"+name;
+        if (data_file.size()>=sizeof(shm_buf::data_file))
+            throw std::invalid_argument("swmr_ringbuffer::construct: path of the data file too long: "+data_file);
+    }
+
+    char *mem=segment.template construct<char>( name )[get_shm_size(buf_size,max_readers,memory)]();
+    mem+=(CACHE_LINE - reinterpret_cast<uintptr_t>(mem)%CACHE_LINE)%CACHE_LINE;
+
+    shm_buf *hdr=new (mem) shm_buf();
+    hdr->magic      =SHM_MAGIC;
+    hdr->version    =SHM_VERSION;
+    hdr->elem_size  =sizeof(T);
+    strncpy(hdr->elem_type,typeid(T).name(),sizeof(hdr->elem_type)-1);
+    hdr->sync       =static_cast<uint32_t>(SYNC);
+    hdr->max_readers=max_readers;
+    hdr->buf_size   =buf_size;
+    hdr->overflow   =static_cast<uint32_t>(overflow);
+
+    strncpy(hdr->data_file,data_file.c_str(),sizeof(hdr->data_file)-1);
+    hdr->data_map_size=data_file.empty()? 0 : data_file_size(buf_size,page_size);
+    hdr->page_size    =page_size;
+    hdr->huge_pages   =huge_pages;
+    hdr->numa_node    =memory.numa_node;
+    hdr->prefault     =memory.prefault;
+    hdr->lock         =memory.lock;
+
+    for (size_t k=0;k<max_readers;k++)
+        new (mem+readers_offset()+k*sizeof(reader_descr)) reader_descr();
+    for (size_t w=0;w<(max_readers+63)/64*2;w++)
+        new (mem+active_offset(max_readers)+w*sizeof(std::atomic<uint64_t>)) std::atomic<uint64_t>(0);
+
+    // Create the data file, bind it to the NUMA node and allocate its pages
+    try {
+        void  *data=mem+data_offset(max_readers);
+        size_t len =buf_size*sizeof(T);
+        if (!data_file.empty()) {
+            int fd=open(hdr->data_file,O_RDWR|O_CREAT|O_TRUNC,0600);
+            if (fd<0 || ftruncate(fd,hdr->data_map_size)!=0) {
+                std::string err=strerror(errno);
+                if (fd>=0)
+                    close(fd);
+                throw std::runtime_error("swmr_ringbuffer::construct: cannot create "+data_file+": "+err);
+            }
+            data=mmap(NULL,hdr->data_map_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+            close(fd);
+            if (data==MAP_FAILED)
+                throw std::runtime_error("swmr_ringbuffer::construct: cannot map "+data_file+": "+strerror(errno));
+            len=hdr->data_map_size;
+        }
+
+        try {
+            if (memory.numa_node>=0)
+                swmr_detail::bind_numa_node(data,len,page_size,memory.numa_node);
+            if (memory.prefault)
+                swmr_detail::prefault(data,len,page_size,true);
+        } catch (...) {
+            if (!data_file.empty())
+                munmap(data,len);
+            throw;
+        }
+        if (!data_file.empty())
+            munmap(data,len);
+    } catch (...) {
+        if (!data_file.empty())
+            unlink(data_file.c_str());
+        segment.template destroy<char>(name);
+        throw;
+    }
+
+    create_mutex(name,segment);
     return true;
 }
 
-template <typename T,size_t BUF_SIZE,size_t NUM_READERS>
-bool swmr_ringbuffer<T,BUF_SIZE,NUM_READERS>::remove(
+template <typename T,swmr_sync SYNC>
+bool swmr_ringbuffer<T,SYNC>::remove(
                        const char * name
                       )
 {
@@ -153,11 +967,172 @@ bool swmr_ringbuffer<T,BUF_SIZE,NUM_READERS>::remove(
     return true;
 }
 
+template <typename T,swmr_sync SYNC>
+template <typename SEGMENT>
+bool swmr_ringbuffer<T,SYNC>::remove(
+                       const char * name,
+                       SEGMENT& segment
+                      )
+{
+    char *mem=segment.template find<char>( name ).first;
+    if (mem!=NULL) {
+        mem+=(CACHE_LINE - reinterpret_cast<uintptr_t>(mem)%CACHE_LINE)%CACHE_LINE;
+        const shm_buf *hdr=reinterpret_cast<const shm_buf*>(mem);
+        if (hdr->magic==SHM_MAGIC && hdr->version==SHM_VERSION && hdr->data_file[0]!=0)
+            unlink(hdr->data_file);
+        segment.template destroy<char>(name);
+    }
+    remove_mutex(name,segment);
+    return true;
+}
 
-template <typename T,size_t BUF_SIZE,size_t NUM_READERS>
-swmr_ringbuffer<T,BUF_SIZE,NUM_READERS>::swmr_ringbuffer(const char * name,boost::interprocess::managed_shared_memory& segment)
+/*
+ * In shared memory the mutex is a named mutex (with the name of the buffer), in
+ * heap memory a std::mutex in the segment: only the threads of this process can
+ * use the buffer, and destroying the segment leaves nothing behind.
+ */
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::create_mutex(const char *name,boost::interprocess::managed_shared_memory& segment)
+{
+    boost::interprocess::named_mutex mutex(boost::interprocess::create_only,name);
+}
+
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::create_mutex(const char *name,boost::interprocess::managed_heap_memory& segment)
 {
-    buf=segment.find<shm_buf>( name ).first;
+    segment.construct<std::mutex>(local_mutex_name(name).c_str())();
+}
 
-    mutex=new boost::interprocess::named_mutex(boost::interprocess::open_only,name);
+template <typename T,swmr_sync SYNC>
+typename swmr_ringbuffer<T,SYNC>::ring_mutex *
+swmr_ringbuffer<T,SYNC>::open_mutex(const char *name,boost::interprocess::managed_shared_memory& segment)
+{
+    return new named_ring_mutex(name);
+}
+
+template <typename T,swmr_sync SYNC>
+typename swmr_ringbuffer<T,SYNC>::ring_mutex *
+swmr_ringbuffer<T,SYNC>::open_mutex(const char *name,boost::interprocess::managed_heap_memory& segment)
+{
+    std::mutex *mutex=segment.find<std::mutex>(local_mutex_name(name).c_str()).first;
+    if (mutex==NULL)
+        throw std::runtime_error(std::string("swmr_ringbuffer: cannot find the mutex of ")+name);
+    return new local_ring_mutex(mutex);
+}
+
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::remove_mutex(const char *name,boost::interprocess::managed_shared_memory& segment)
+{
+    remove(name);
+}
+
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::remove_mutex(const char *name,boost::interprocess::managed_heap_memory& segment)
+{
+    segment.destroy<std::mutex>(local_mutex_name(name).c_str());
+}
+
+
+template <typename T,swmr_sync SYNC>
+template <typename SEGMENT>
+swmr_ringbuffer<T,SYNC>::swmr_ringbuffer(const char * name,SEGMENT& segment)
+{
+    char *mem=segment.template find<char>( name ).first;
+    if (mem==NULL)
+        throw std::runtime_error(std::string("swmr_ringbuffer: cannot find ")+name);
+    mem+=(CACHE_LINE - reinterpret_cast<uintptr_t>(mem)%CACHE_LINE)%CACHE_LINE;
+
+    // Check that the structure has been created for this type of ring buffer
+    buf=reinterpret_cast<shm_buf*>(mem);
+    if (buf->magic!=SHM_MAGIC || buf->version!=SHM_VERSION)
+        throw std::runtime_error(std::string("swmr_ringbuffer: ")+name+" is not a ring buffer or has a different version");
+    if (buf->elem_size!=sizeof(T) || strncmp(buf->elem_type,typeid(T).name(),sizeof(buf->elem_type)-1)!=0)
+        throw std::runtime_error(std::string("swmr_ringbuffer: ")+name+" has been created for elements of type "+buf->elem_type);
+    if (buf->sync!=static_cast<uint32_t>(SYNC))
+        throw std::runtime_error(std::string("swmr_ringbuffer: ")+name+" has been created with a different swmr_sync policy");
+
+    buf_size   =buf->buf_size;
+    num_readers=buf->max_readers;
+    readers    =reinterpret_cast<reader_descr*>(mem+readers_offset());
+    active     =reinterpret_cast<std::atomic<uint64_t>*>(mem+active_offset(num_readers));
+    active_words=(num_readers+63)/64;
+    critical    =active+active_words;
+    overflow    =static_cast<swmr_overflow>(buf->overflow);
+    acquired_seq.assign(num_readers,0);
+    acquired_n.assign(num_readers,0);
+    attached.assign(num_readers,false);
+    attach_data(mem);
+
+    try {
+        mutex=open_mutex(name,segment);
+    } catch (...) {
+        if (data_map!=NULL)
+            munmap(data_map,data_map_size);
+        throw;
+    }
+}
+
+template <typename T,swmr_sync SYNC>
+swmr_ringbuffer<T,SYNC>::~swmr_ringbuffer()
+{
+    for (size_t k=0;k<attached.size();k++)
+        if (attached[k])
+            detach_reader(k);
+    if (data_map!=NULL)
+        munmap(data_map,data_map_size);     // Also unlocks it
+    else if (buf!=NULL && buf->lock)
+        munlock(data,buf_size*sizeof(T));
+    delete mutex;
+}
+
+/*
+ * The mapping of the data and mlock() are per process, so they are done here,
+ * as recorded in the header by construct().
+ */
+template <typename T,swmr_sync SYNC>
+void swmr_ringbuffer<T,SYNC>::attach_data(char *mem)
+{
+    size_t len=buf_size*sizeof(T);
+    if (buf->data_file[0]==0)
+        data=reinterpret_cast<T*>(mem+data_offset(num_readers));
+    else {
+        int fd=open(buf->data_file,O_RDWR);
+        if (fd<0)
+            throw std::runtime_error(std::string("swmr_ringbuffer: cannot open ")+buf->data_file+": "+strerror(errno));
+        void *map=mmap(NULL,buf->data_map_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+        close(fd);
+        if (map==MAP_FAILED)
+            throw std::runtime_error(std::string("swmr_ringbuffer: cannot map ")+buf->data_file+": "+strerror(errno));
+        data_map     =map;
+        data_map_size=buf->data_map_size;
+        data         =static_cast<T*>(map);
+    }
+
+    if (buf->prefault)
+        swmr_detail::prefault(data,len,buf->page_size,false);
+
+    if (buf->lock && mlock(data,len)!=0) {
+        std::string err=strerror(errno);
+        if (data_map!=NULL)
+            munmap(data_map,data_map_size);
+        throw std::runtime_error("swmr_ringbuffer: cannot lock the data in RAM (check 'ulimit -l'): "+err);
+    }
+}
+
+template <typename T,swmr_sync SYNC>
+std::string swmr_ringbuffer<T,SYNC>::backing() const
+{
+    std::ostringstream descr;
+    if (buf->data_file[0]==0)
+        descr << "shared memory segment";
+    else
+        descr << (buf->huge_pages? "hugetlbfs file " : "file ") << buf->data_file;
+    descr << ", " << buf->page_size/1024 << " kB pages";
+    if (buf->numa_node>=0)
+        descr << ", NUMA node " << buf->numa_node;
+    if (buf->prefault)
+        descr << ", prefaulted";
+    if (buf->lock)
+        descr << ", locked in RAM";
+    return descr.str();
 }
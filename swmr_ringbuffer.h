@@ -2,10 +2,145 @@
 #define __SWMR_RINGBUFFER
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <boost/interprocess/sync/named_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/interprocess/sync/interprocess_semaphore.hpp>
+#include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/managed_heap_memory.hpp>
 
 
+/**
+ * How writer and readers of a swmr_ringbuffer synchronise with each other.
+ */
+enum class swmr_sync {
+    /// Writer and readers are serialised by a named mutex. The writer moves
+    /// forward the read pointers of the readers it overruns.
+    locked,
+    /// No lock at all. The writer publishes a 64-bit sequence counter, each
+    /// reader checks after its copy whether the writer has overrun it (in the
+    /// style of a seqlock). Readers can never block the writer.
+    lock_free
+};
+
+
+/**
+ * What the writer of a swmr_ringbuffer does when the buffer is full for one of
+ * the critical readers (see swmr_ringbuffer::attach_reader()). The readers that
+ * are not critical (best effort) never limit the writer: they lose the oldest
+ * data if they are too slow.
+ */
+enum class swmr_overflow {
+    /// Overwrite the oldest data: critical readers are treated as best effort
+    overwrite,
+    /// The writer waits until the slowest critical reader has made enough space
+    block,
+    /// The writer writes only what fits: the newest data is dropped
+    drop_newest
+};
+
+
+/**
+ * Where a reader starts reading when it attaches to a swmr_ringbuffer.
+ */
+enum class swmr_start {
+    /// Only the data written after attaching
+    head,
+    /// The oldest data still in the buffer
+    oldest
+};
+
+
+/**
+ * Where and how the data of a swmr_ringbuffer is placed in memory. Used only
+ * when creating the data structure (see swmr_ringbuffer::construct()): it is
+ * recorded in the shared memory header, so that the processes attaching to
+ * the buffer apply the same choices transparently.
+ */
+struct swmr_memory_options {
+    /// If not empty, the data is not stored in the managed shared memory segment,
+    /// but in a file created in this directory and mapped by each process. Give a
+    /// hugetlbfs mount point (e.g. /dev/hugepages) to use huge pages.
+    std::string hugetlbfs_dir;
+    /// If >=0, the pages of the data are bound to this NUMA node (Linux only)
+    int numa_node=-1;
+    /// Touch all the pages of the data when creating and when attaching, so that
+    /// no page fault happens in the write and read paths
+    bool prefault=false;
+    /// Lock the data in RAM (mlock) in every process that attaches to the buffer
+    bool lock=false;
+};
+
+
+/**
+ * Counters of one reader of a swmr_ringbuffer (see swmr_stats).
+ */
+struct swmr_reader_stats {
+    bool     active=false;    ///< if the reader is attached
+    bool     critical=false;  ///< if the reader is critical (see swmr_overflow)
+    uint32_t pid=0;           ///< the process that has attached the reader
+    uint64_t seq=0;           ///< sequence number of the next element to read
+    uint64_t lag=0;           ///< elements available to read now (at most buf_size)
+    uint64_t read=0;          ///< elements read (copied or released)
+    uint64_t lost=0;          ///< elements lost because the writer overran the reader
+    uint64_t overruns=0;      ///< how many times data was found lost
+    uint64_t max_lag=0;       ///< high water mark of 'lag' (seen when reading)
+    uint64_t lock_wait_ns=0;  ///< time spent waiting for the mutex ('locked' policy)
+    uint64_t lock_hold_ns=0;  ///< time spent holding the mutex ('locked' policy)
+};
+
+/**
+ * Snapshot of the counters of a swmr_ringbuffer, kept in shared memory since
+ * its creation. The counters are updated with relaxed atomics: a snapshot is
+ * not taken atomically, but each counter is consistent.
+ */
+struct swmr_stats {
+    uint64_t buf_size=0;      ///< size of the buffer (elements)
+    uint64_t write_seq=0;     ///< sequence number of the next element to write
+    uint64_t written=0;       ///< elements written (committed)
+    uint64_t writes=0;        ///< number of writes (commits)
+    uint64_t overruns=0;      ///< how many times the writer moved forward a slow reader ('locked' policy)
+    uint64_t dropped=0;       ///< elements not written because the buffer was full (swmr_overflow::drop_newest)
+    uint64_t blocked_ns=0;    ///< time the writer spent waiting for space (swmr_overflow::block)
+    uint64_t lock_wait_ns=0;  ///< time the writer spent waiting for the mutex ('locked' policy)
+    uint64_t lock_hold_ns=0;  ///< time the writer spent holding the mutex ('locked' policy)
+    std::vector<swmr_reader_stats> readers;
+};
+
+
+/**
+ * A region of a swmr_ringbuffer handed out for zero-copy access.
+ * Because of the wrap around at the buffer bottom, a region is made of up to
+ * two contiguous spans: 'n1' elements at 'data1', followed by 'n2' elements
+ * at 'data2' (n2 is possibly zero).
+ */
+template <typename T> struct swmr_region {
+    T*     data1=NULL;
+    size_t n1=0;
+    T*     data2=NULL;
+    size_t n2=0;
+
+    /// Total number of elements in the region
+    size_t size() const { return n1+n2; }
+
+    /// Pointer to element 'k' of the region. 'n_contig' is set to how many
+    /// elements are contiguous in memory from there.
+    T* at(size_t k,size_t& n_contig) const
+    {
+        if (k<n1) {
+            n_contig=n1-k;
+            return data1+k;
+        }
+        n_contig=n1+n2-k;
+        return data2+(k-n1);
+    }
+};
+
 
 /**
  * Single Writer, Multiple Reader ring buffer.
@@ -17,34 +152,92 @@
  *
  * When writing, the writer will never block, but will go on writing data regardless
  * of the readers. If one of the readers is too slow to extract data, that reader
- * will lose (the oldest) data.
+ * will lose (the oldest) data. This is unless the buffer has been created with the
+ * swmr_overflow::block or swmr_overflow::drop_newest policy and the reader is critical.
+ *
+ * Positions in the buffer are tracked with monotonically increasing 64-bit sequence
+ * numbers: element 'k' of the written sequence is stored at data[k % buf_size].
+ * Two synchronisation policies can be selected with the SYNC template parameter
+ * (see swmr_sync):
+ *  - swmr_sync::locked (default): every read/write takes a named mutex and the writer
+ *    moves forward the read pointer of the readers it overruns.
+ *  - swmr_sync::lock_free: no lock is taken. Each reader detects on its own if the
+ *    writer has overrun it, and skips the lost data. The loss semantics are the same
+ *    (a slow reader loses the oldest data), but a reader can never stall the writer.
  *
- * The implementation uses a semaphore for locking, but it can be easily modified to
- * not use locking (in which case the writer overrun woudl behave differently).
+ * The ring buffer can have up to 'max_readers' readers. Each is identified by an
+ * unsigned integer 0, 1, ... (max_readers-1): a reader gets a free identifier with
+ * attach_reader() (or claims a given one) and frees it with detach_reader(). The
+ * writer only looks at the attached readers, and the identifiers of readers whose
+ * process has died are reclaimed.
  *
- * The ring buffer can have up to NUM_READERS readers. Each is identified by an
- * unsigned integer 0, 1, ... (NUM_READERS-1).
+ * Readers can be attached as critical: when one of them is too slow, instead of
+ * overwriting its data the writer can wait for it or drop the new data (the
+ * swmr_overflow policy, chosen when creating the buffer).
  *
  * This ringbuffer is to be used for communication between different therads/processes,
- * so all methods are thread/process safe (using BOOST interprocess::named_mutex).
+ * so all methods are thread/process safe (using BOOST interprocess::named_mutex or
+ * atomic counters, depending on the SYNC policy).
  * To ensure inter-process capability the ring buffer itself is placed in shared memory,
  * using BOOST 'interprocess::managed_shared_memory'.
+ * For the threads of a single process, the ring buffer can be placed instead in a
+ * BOOST 'interprocess::managed_heap_memory' segment (the SEGMENT parameter of
+ * construct(), remove(), stats() and of the constructor): the API is the same,
+ * but the mutex is a std::mutex in the segment instead of a named mutex, and
+ * nothing is left behind in the system when the segment is destroyed.
  * This object itself is not in shared memory, but has a pointer to the shared data
  * memory structure.
  *
- * The type of data in the buffer, the size (statically allocated at creation) and
- * the max number of readers are all template parameters.
+ * The type of data in the buffer and the synchronisation policy are template parameters.
+ * The size of the buffer and the max number of readers are chosen at run time, when
+ * creating the data structure in shared memory. These, together with the size and
+ * type of the elements, are stored in a header at the start of the shared memory
+ * structure, so that the processes attaching to the buffer can find the size and
+ * check that they are using the right type.
  *
  * Note that the shared memory data structures need to be created before calling the
  * constructor: see comments for the constructor and the static method construct()
  */
-template <typename T,size_t BUF_SIZE,size_t NUM_READERS> class swmr_ringbuffer {
+template <typename T,swmr_sync SYNC=swmr_sync::locked> class swmr_ringbuffer {
 
 public:
+    /**
+     * Attaches a reader: leases a free reader identifier to this process. If there
+     * is no free one, the identifiers of the readers whose process has died are
+     * reclaimed. Will throw 'std::runtime_error' if all are in use.
+     *
+     * @returns the identifier of the reader, to use with the read methods
+     */
+    size_t attach_reader(
+                         swmr_start start=swmr_start::oldest, ///< where to start reading >.
+                         bool critical=false                  ///< if the writer must not overwrite its data (see swmr_overflow) >.
+                        );
+
+    /**
+     * Attaches a reader with a given identifier. Will throw 'std::invalid_argument'
+     * if reader_id is invalid and 'std::runtime_error' if it is in use by another
+     * process that is still alive.
+     */
+    void attach_reader(
+                       size_t reader_id,                    ///< Identifier of the reader >.
+                       swmr_start start=swmr_start::oldest, ///< where to start reading >.
+                       bool critical=false                  ///< if the writer must not overwrite its data (see swmr_overflow) >.
+                      );
+
+    /**
+     * Frees the identifier of a reader attached by this process (this is also done
+     * by the destructor). Will throw 'std::invalid_argument' if reader_id is not
+     * attached by this object.
+     */
+    void detach_reader(
+                       size_t reader_id ///< Identifier of the reader >.
+                      );
+
     /**
      * Writes 'n' elements in the ring buffer.
-     * The write always succedes fully, if n<BUF_SIZE. if n is bigger,
-     * only BUF_SIZE points will be written
+     * The write always succedes fully, if n<buf_size. if n is bigger,
+     * only buf_size points will be written (with swmr_overflow::drop_newest,
+     * only what fits for the critical readers).
      *
      * @returns the number of points written
      */
@@ -53,13 +246,90 @@ public:
                 size_t n        ///< number of elements to write >.
                 );
 
+    /**
+     * Zero-copy write, first step: returns a region of 'n' elements (at most
+     * buf_size) inside the ring buffer, where the caller can directly put the
+     * data to write. The data is not visible to the readers until commit_write()
+     * is called, but the readers that would read from the region skip it as
+     * lost data as soon as it is reserved.
+     * With swmr_overflow::block, waits until there is space for 'n' elements for
+     * all the critical readers. With swmr_overflow::drop_newest, the region is
+     * smaller than 'n' (possibly empty) if there is not enough space.
+     *
+     * @returns the region to fill
+     */
+    swmr_region<T> reserve_write(
+                                 size_t n ///< number of elements to write >.
+                                );
+
+    /**
+     * Zero-copy write, second step: publishes the first 'n' elements of the region
+     * returned by the last reserve_write() ('n' can be less than reserved).
+     * The readers that have been overrun are adjusted now.
+     * Will throw 'std::invalid_argument', if 'n' is more than reserved.
+     */
+    void commit_write(
+                      size_t n ///< number of elements written >.
+                     );
+
     /**
      * Writes a single data element. Always succedes.
+     * To write many single elements, a producer is much cheaper.
      */
     void write(
               const T& data ///< single element to write >.
               );
 
+    /**
+     * Handle for the writer that writes one element at a time: the elements are
+     * collected in a local batch, and written to the ring buffer with a single
+     * write (one commit) when the batch is full, when the oldest element in the
+     * batch has waited for 'max_latency_usec' microseconds, or on flush().
+     * The latency is checked when pushing and by flush_if_due(), which the
+     * writer should call when it has nothing to push for a while. The batch is
+     * flushed when the producer is destroyed.
+     */
+    class producer {
+    public:
+        producer(
+                 swmr_ringbuffer& ring,          ///< the ring buffer to write to >.
+                 size_t batch_size,              ///< max elements in the batch (at most the buffer size) >.
+                 unsigned long max_latency_usec  ///< max time an element waits in the batch >.
+                );
+        ~producer();
+
+        producer(const producer&) = delete;
+        producer& operator=(const producer&) = delete;
+
+        /// Adds an element to the batch, flushing if needed
+        void push(const T& x)
+        {
+            if (n_pending==0)
+                deadline=std::chrono::steady_clock::now()+max_latency;
+            batch[n_pending++]=x;
+            if (n_pending==batch.size() || std::chrono::steady_clock::now()>=deadline)
+                flush();
+        }
+
+        /// Writes the batch to the ring buffer. Returns how many elements were written
+        /// (less than pending only with swmr_overflow::drop_newest)
+        size_t flush();
+
+        /// Flushes if the oldest element in the batch has waited too long.
+        /// Returns true if it has flushed.
+        bool flush_if_due();
+
+        /// Number of elements in the batch, not yet written
+        size_t pending() const { return n_pending; }
+
+    private:
+        swmr_ringbuffer& ring;
+        std::vector<T>   batch;
+        size_t           n_pending=0;
+        std::chrono::steady_clock::duration   max_latency;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
     /**
      * Reads up to 'n' elements from the ring buffer.
      * Will throw 'std::invalid_argument', if reader_id is invalid.
@@ -74,6 +344,98 @@ public:
                );
 
 
+    /**
+     * Blocking read: waits until at least 'min_n' elements are available to read
+     * (or until 'timeout_msec' milliseconds have passed) and then reads up to 'max_n'
+     * elements, as read() does.
+     * The writer wakes up the reader only when 'min_n' elements are available, so
+     * 'min_n' is a low watermark that limits how frequently the reader is woken up,
+     * while 'timeout_msec' bounds the latency. The wake up is a semaphore post,
+     * which never blocks the writer.
+     * Will throw 'std::invalid_argument', if reader_id is invalid.
+     *
+     * @returns the number of points read (could be less than 'min_n' if
+     *          the timeout expired).
+     */
+    size_t read_wait(
+                     size_t reader_id,          ///< Identifier of the reader >.
+                     T* read_buf,               ///< Pointer  to where the read data will be copied>.
+                     size_t min_n,              ///< min number of elements to wait for >.
+                     size_t max_n,              ///< max number of elements to read >.
+                     unsigned long timeout_msec ///< max time to wait (msec) >.
+                    );
+
+    /**
+     * Waits until at least 'min_n' elements are available to read (or until
+     * 'timeout_msec' milliseconds have passed), without reading them.
+     * To be used before acquire_read() for blocking zero-copy reads.
+     * Will throw 'std::invalid_argument', if reader_id is invalid.
+     *
+     * @returns how many data points are available to read
+     */
+    size_t wait_available(
+                          size_t reader_id,          ///< Identifier of the reader >.
+                          size_t min_n,              ///< min number of elements to wait for >.
+                          unsigned long timeout_msec ///< max time to wait (msec) >.
+                         );
+
+    /**
+     * For event loops serving many ring buffers (see ring_reactor.h): instead of
+     * blocking in wait_available(), asks the writer to notify the reader when at
+     * least 'min_n' elements are available: the writer increments the futex word of
+     * the reader (see notify_word()) and wakes up who waits on it. The caller reads
+     * the word before arming, and waits for it to change (FUTEX_WAIT or futex_waitv
+     * with the value read), so the notification cannot be lost.
+     * Returns true, without arming, if the elements are already available.
+     * Will throw 'std::invalid_argument', if reader_id is invalid.
+     */
+    bool arm_notify(
+                    size_t reader_id,          ///< Identifier of the reader >.
+                    size_t min_n               ///< min number of elements to be notified for >.
+                   );
+
+    /**
+     * Cancels the request of arm_notify() (a notification already sent is not
+     * cancelled: the word may have changed anyway).
+     */
+    void disarm_notify(
+                       size_t reader_id        ///< Identifier of the reader >.
+                      );
+
+    /**
+     * Returns the futex word of a reader, in shared memory (see arm_notify())
+     */
+    const std::atomic<uint32_t>* notify_word(size_t reader_id) const;
+
+    /**
+     * Zero-copy read: returns up to 'max_n' elements that are available to read,
+     * as a region pointing directly into the ring buffer.
+     * The read position is not moved until release_read() is called, and the
+     * data is not protected while the caller uses it: if the caller takes too long
+     * the writer can overwrite it (this is reported by release_read()).
+     * Will throw 'std::invalid_argument', if reader_id is invalid.
+     *
+     * @returns the region (empty if there is nothing to read).
+     */
+    swmr_region<const T> acquire_read(
+                                      size_t reader_id, ///< Identifier of the reader >.
+                                      size_t max_n      ///< max number of elements >.
+                                     );
+
+    /**
+     * Moves the read position forward by 'n' elements, which must be at most the
+     * size of the region returned by the last acquire_read() (less what has already
+     * been released).
+     * Will throw 'std::invalid_argument', if reader_id is invalid or 'n' is too big.
+     *
+     * @returns how many of the 'n' elements have been (possibly) overwritten by the
+     *          writer while the region was held: 0 if all the data was valid.
+     */
+    size_t release_read(
+                        size_t reader_id, ///< Identifier of the reader >.
+                        size_t n          ///< number of elements consumed >.
+                       );
+
     /**
      * Returns the number of elements that can be read by a reader.
      * Will throw 'std::invalid_argument', if reader_id is invalid.
@@ -86,65 +448,346 @@ public:
                          );
 
     /**
-     * Returns the size of the shared memory data structure.
+     * Returns the size of the buffer (how many elements it can hold).
+     */
+    uint64_t capacity() const { return buf_size; }
+
+    /**
+     * Returns the max number of readers.
+     */
+    size_t max_readers() const { return num_readers; }
+
+    /**
+     * Returns a snapshot of the counters of the writer and of all the readers.
+     */
+    swmr_stats stats() const { return get_stats(buf,readers,active); }
+
+    /**
+     * Returns a snapshot of the counters of the ring buffer 'name', without
+     * attaching to it (so it does not need the mutex nor the data). The segment
+     * can be opened read-only. Will throw 'std::runtime_error' if the data structure
+     * is not found or is not a ring buffer of this version.
+     */
+    template <typename SEGMENT>
+    static swmr_stats stats(
+                            const char * name,
+                            SEGMENT& segment
+                           );
+
+    /**
+     * Returns a description of where the data is stored (shared memory segment
+     * or file, page size, NUMA node, locked in RAM).
      */
-    static size_t get_shm_size();
+    std::string backing() const;
+
+    /**
+     * Returns the size of the shared memory data structure, for a buffer of
+     * 'buf_size' elements and 'max_readers' readers. The data is not counted
+     * if it is stored in a file (see swmr_memory_options::hugetlbfs_dir).
+     */
+    static size_t get_shm_size(
+                               uint64_t buf_size,  ///< size of the buffer (elements) >.
+                               size_t max_readers, ///< max number of readers >.
+                               const swmr_memory_options& memory=swmr_memory_options() ///< placement of the data >.
+                              );
 
     /**
      * Build the data structure in shared memory.
      * Needs to be called (possibly by a different process) before calling
      * the constructor.
+     * Will throw 'std::invalid_argument' if the parameters are not valid and
+     * 'std::runtime_error' if the data memory cannot be set up as requested.
      * The shared memeory data structures will persist process termination
      * and need ot be destroyed explicitly with:
-     *    swmr_ringbuffer<...>::remove(name)
+     *    swmr_ringbuffer<...>::remove(name,segment)
      */
+    template <typename SEGMENT>
     static bool construct(
                            const char * name,
-                           boost::interprocess::managed_shared_memory& segment
+                           SEGMENT& segment,
+                           uint64_t buf_size,  ///< size of the buffer (elements) >.
+                           size_t max_readers, ///< max number of readers >.
+                           swmr_overflow overflow=swmr_overflow::overwrite, ///< what to do when full for a critical reader >.
+                           const swmr_memory_options& memory=swmr_memory_options() ///< placement of the data >.
                          );
 
     /**
-     * Destroys the shared memeory data structures.
+     * Destroys the named mutex only (use this if the segment is not available
+     * any more, e.g. to clean up after an aborted execution).
      */
     static bool remove(
                        const char * name
                       );
 
+    /**
+     * Destroys the shared memeory data structures: the named mutex (the mutex in
+     * the segment, for heap memory), the data structure in 'segment' and the data
+     * file, if any.
+     */
+    template <typename SEGMENT>
+    static bool remove(
+                       const char * name,
+                       SEGMENT& segment
+                      );
+
     /**
      * This creates the instance that will be used by the process that calls it,
      * but the shared data structure must already have been created beforehand
      * in shared memory (with 'name') using the static method:
-     *     swmr_ringbuffer<...>::construct(name,segment)
+     *     swmr_ringbuffer<...>::construct(name,segment,buf_size,max_readers)
+     * The size of the buffer and the max number of readers are read from the shared
+     * memory header. Will throw 'std::runtime_error' if the data structure is not found
+     * or if it was created for a different element type or synchronisation policy.
      */
+    template <typename SEGMENT>
     swmr_ringbuffer(
                     const char * name,
-                    boost::interprocess::managed_shared_memory& segment
+                    SEGMENT& segment
                    );
 
+    ~swmr_ringbuffer();
+
+    // Owns the mapping of the data and the mutex: cannot be copied
+    swmr_ringbuffer(const swmr_ringbuffer&) = delete;
+    swmr_ringbuffer& operator=(const swmr_ringbuffer&) = delete;
+
 private:
 
-    // The data structure in shared memory. Just the poinetr is stored in this object
+    // The counters live in shared memory and are used by different processes,
+    // so they must be real lock-free atomics (not emulated with a lock)
+    static_assert(ATOMIC_LLONG_LOCK_FREE==2,"swmr_ringbuffer requires lock-free 64-bit atomics");
+
+    // Identifies the header of a swmr_ringbuffer data structure, and its layout version
+    static const uint32_t SHM_MAGIC=0x524d5753; // "SWMR"
+    static const uint32_t SHM_VERSION=6;
+
+    // The parts of the data structure that are written by different processes are
+    // aligned to (and padded to) this size, to avoid false sharing.
+    static const size_t CACHE_LINE=64;
+
+    // The header of the data structure in shared memory. It is followed by the
+    // descriptors of the readers and by the data (both aligned to CACHE_LINE).
+    // Just the pointers are stored in this object
     struct shm_buf
     {
-        // Only one writer, only one write index (pointer), i.e. where the next
-        // element will be written
-        size_t write_index;
-
-        // One entry for each reader: the index of where next element will be read
-        // and how many are available to read
-        struct {
-            // The index (pointer) to the element that would be read next
-            size_t index;
-            // How many elements are available to read. Make it 32 bit to ensure reading
-            // is atomic on the majority of reasonably modern CPU architectures
-            uint32_t available;
-        } reader_descr [NUM_READERS];
-
-        // Where the data is stored
-        T data[BUF_SIZE];
+        // Written once at creation, used to validate when attaching
+        uint32_t magic;
+        uint32_t version;
+        uint64_t elem_size;        // sizeof(T)
+        char     elem_type[48];    // name of T (typeid), possibly truncated
+        uint32_t sync;             // the swmr_sync policy
+        uint32_t max_readers;
+        uint64_t buf_size;         // how many elements in the buffer
+        uint32_t overflow;         // the swmr_overflow policy
+
+        // Where the data is stored (see swmr_memory_options)
+        char     data_file[128];   // empty if the data follows the readers descriptors
+        uint64_t data_map_size;    // size of the data file (multiple of the page size)
+        uint64_t page_size;        // page size of the data memory
+        uint32_t huge_pages;       // 1 if the data file is on hugetlbfs
+        int32_t  numa_node;        // -1 if not bound
+        uint32_t prefault;
+        uint32_t lock;
+
+        // Counters of the writer (see swmr_stats), on a cache line of their own
+        struct alignas(CACHE_LINE) {
+            std::atomic<uint64_t> written;
+            std::atomic<uint64_t> writes;
+            std::atomic<uint64_t> overruns;
+            std::atomic<uint64_t> dropped;
+            std::atomic<uint64_t> blocked_ns;
+            std::atomic<uint64_t> lock_wait_ns;
+            std::atomic<uint64_t> lock_hold_ns;
+        } stats;
+
+        // The writer waiting for space (swmr_overflow::block) waits on this. The
+        // critical reader it is waiting for posts it (see reader_descr::space_seq).
+        struct writer_wait_t {
+            boost::interprocess::interprocess_semaphore sem;
+            writer_wait_t() : sem(0) {}
+        } writer_wait;
+
+        // Only one writer, only one write sequence number: how many elements have
+        // been written (and published) since creation. The next element will be
+        // written at data[write_seq % buf_size]
+        alignas(CACHE_LINE) std::atomic<uint64_t> write_seq;
+
+        // The end of the region the writer is copying into. It is updated before
+        // the copy, while 'write_seq' is updated after, so a reader that accesses the
+        // data without holding the mutex (lock-free or zero-copy reads) can tell if
+        // its data was overwritten while it was using it.
+        std::atomic<uint64_t> write_claim;
     } *buf=NULL;
 
-    boost::interprocess::named_mutex *mutex=NULL;   // The mutex that makes it thread/process safe
+    // One entry for each reader: the sequence number of the element that would
+    // be read next. With the 'locked' policy the writer moves it forward when
+    // the reader is overrun, with 'lock_free' only the reader updates it.
+    // The reader waiting for data sets 'wake_seq' to the write sequence number
+    // at which the writer should wake it up (0 if not waiting), and waits on
+    // 'wake_sem'. Posting a semaphore never blocks, so a reader can never
+    // block the writer (even if it dies while waiting).
+    // The counters of the reader (see swmr_reader_stats) are on a cache line of
+    // their own. They are updated by the reader, and by the writer when it moves
+    // forward 'seq' (with the 'locked' policy, holding the mutex).
+    struct alignas(CACHE_LINE) reader_descr {
+        std::atomic<uint64_t> seq;
+
+        std::atomic<uint64_t> wake_seq;
+        boost::interprocess::interprocess_semaphore wake_sem;
+
+        // Instead of posting 'wake_sem', the writer increments 'notify_word' and
+        // wakes up the futex waiters on it, if 'notify' is set (see arm_notify())
+        std::atomic<uint32_t> notify;
+        std::atomic<uint32_t> notify_word;
+
+        // The process that has attached the reader (0 if free)
+        std::atomic<uint32_t> pid;
+
+        // Set by the writer waiting for space to the read sequence number this
+        // (critical) reader must reach to wake it up (0 if not waiting)
+        std::atomic<uint64_t> space_seq;
+
+        struct alignas(CACHE_LINE) {
+            std::atomic<uint64_t> read;
+            std::atomic<uint64_t> lost;
+            std::atomic<uint64_t> overruns;
+            std::atomic<uint64_t> max_lag;
+            std::atomic<uint64_t> lock_wait_ns;
+            std::atomic<uint64_t> lock_hold_ns;
+        } stats;
+
+        reader_descr() : seq(0), wake_seq(0), wake_sem(0), notify(0), notify_word(0), pid(0), space_seq(0), stats() {}
+    } *readers=NULL;
+
+    // Bit mask of the attached readers (bit k%64 of word k/64 for reader k). It
+    // follows the readers descriptors. The writer only looks at these readers.
+    // It is followed by the mask of the critical readers.
+    std::atomic<uint64_t> *active=NULL;
+    std::atomic<uint64_t> *critical=NULL;
+    size_t active_words=0;
+
+    // Copied from the shared memory header
+    swmr_overflow overflow=swmr_overflow::overwrite;
+
+    // With swmr_overflow::block and drop_newest: reduces 'n' to the space left
+    // by the critical readers, waiting for it with 'block'
+    size_t make_space(uint64_t write_seq,size_t n);
+
+    // Stores the new read sequence number of a reader, and wakes up the writer if
+    // it is waiting for it
+    void publish_seq(reader_descr& rd,uint64_t seq,std::memory_order order);
+
+    // Calls f(reader_descr&) for each attached reader
+    template <typename F> void for_each_active(F f);
+
+    // Claims reader 'k' for this process if it is free or its process is dead
+    bool claim_reader(size_t k,uint32_t pid);
+
+    // Sets the read position of reader 'k' and marks it as attached
+    void activate_reader(size_t k,swmr_start start,bool critical);
+
+    // The readers attached by this object (detached by the destructor)
+    std::vector<bool> attached;
+
+    // Where the data is stored
+    T *data=NULL;
+
+    // The mapping of the data file, if the data is not in the segment
+    void  *data_map=NULL;
+    size_t data_map_size=0;
+
+    // Maps the data file, prefaults and locks the data, as recorded in the header
+    void attach_data(char *mem);
+
+    // Size of the data file for 'buf_size' elements and 'page_size' pages
+    static size_t data_file_size(uint64_t buf_size,size_t page_size);
+
+    // Copied from the shared memory header
+    uint64_t buf_size=0;
+    size_t   num_readers=0;
+
+    // Offsets of the readers descriptors, of the mask of the attached readers and
+    // of the data from the start of the data structure
+    static size_t readers_offset();
+    static size_t active_offset(size_t max_readers);
+    static size_t data_offset(size_t max_readers);
+
+    // The mutex that makes it thread/process safe: a named mutex for a buffer in
+    // shared memory, a std::mutex in the segment for a buffer in heap memory
+    class ring_mutex {
+    public:
+        virtual ~ring_mutex() {}
+        virtual void lock()=0;
+        virtual void unlock()=0;
+    };
+    class named_ring_mutex : public ring_mutex {
+    public:
+        named_ring_mutex(const char *name) : mutex(boost::interprocess::open_only,name) {}
+        void lock() override { mutex.lock(); }
+        void unlock() override { mutex.unlock(); }
+    private:
+        boost::interprocess::named_mutex mutex;
+    };
+    class local_ring_mutex : public ring_mutex {
+    public:
+        local_ring_mutex(std::mutex *mutex) : mutex(mutex) {}
+        void lock() override { mutex->lock(); }
+        void unlock() override { mutex->unlock(); }
+    private:
+        std::mutex *mutex;
+    };
+    ring_mutex *mutex=NULL;
+
+    // Create, open and destroy the mutex of the buffer 'name', depending on the
+    // type of segment
+    static void create_mutex(const char *name,boost::interprocess::managed_shared_memory& segment);
+    static void create_mutex(const char *name,boost::interprocess::managed_heap_memory& segment);
+    static ring_mutex *open_mutex(const char *name,boost::interprocess::managed_shared_memory& segment);
+    static ring_mutex *open_mutex(const char *name,boost::interprocess::managed_heap_memory& segment);
+    static void remove_mutex(const char *name,boost::interprocess::managed_shared_memory& segment);
+    static void remove_mutex(const char *name,boost::interprocess::managed_heap_memory& segment);
+    static std::string local_mutex_name(const char *name) { return std::string(name)+".mutex"; }
+
+    // Takes 'mutex' (if not NULL) for its lifetime, and adds to the counters the
+    // time spent waiting for it and holding it
+    class timed_lock {
+    public:
+        timed_lock(ring_mutex *mutex,std::atomic<uint64_t>& wait_ns,std::atomic<uint64_t>& hold_ns);
+        ~timed_lock();
+        timed_lock(const timed_lock&) = delete;
+        timed_lock& operator=(const timed_lock&) = delete;
+    private:
+        ring_mutex *mutex;
+        std::atomic<uint64_t> &hold_ns;
+        std::chrono::steady_clock::time_point locked_at;
+    };
+
+    // The mutex to take: only with the 'locked' policy
+    ring_mutex *sync_mutex() const { return (SYNC==swmr_sync::locked)? mutex : NULL; }
+
+    // Each counter is only updated by one process at a time, so a relaxed load and
+    // store is enough (and cheaper than an atomic read-modify-write)
+    static void count(std::atomic<uint64_t>& counter,uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed)+n,std::memory_order_relaxed);
+    }
+    static void count_max(std::atomic<uint64_t>& counter,uint64_t n)
+    {
+        if (n>counter.load(std::memory_order_relaxed))
+            counter.store(n,std::memory_order_relaxed);
+    }
+
+    static swmr_stats get_stats(const shm_buf *buf,const reader_descr *readers,const std::atomic<uint64_t> *active);
+
+    // For each reader, the sequence number and size of the region handed out by the
+    // last acquire_read(), less what has been released since (only the reader process
+    // uses them, so they are not in shared memory)
+    std::vector<uint64_t> acquired_seq;
+    std::vector<size_t>   acquired_n;
+
+    // The size of the region handed out by the last reserve_write() (only the writer
+    // process uses it)
+    size_t reserved_n=0;
 
     swmr_ringbuffer() {}; // Avoid creation without the needed parameters
 };
@@ -0,0 +1,247 @@
+#include <unistd.h>
+#include <sys/wait.h>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "mwmr_ringbuffer.h"
+
+using namespace boost::interprocess;
+using namespace std;
+
+/*
+
+Benchmark for fan-in: N producer processes write into one mwmr_ringbuffer, read by
+one reader, compared with N swmr_ringbuffer's (one per producer, lock-free policy)
+read in turn by one reader.
+
+Each producer writes 'points' values in writes of 'batch' elements. A value is made of
+the producer number and a counter, so that the reader checks that the values of each
+producer are in increasing order (values can be lost, if the reader is too slow).
+
+Prints, for both cases, the elapsed time, the rate at which the reader received the
+values and how many were lost. The exit status is non zero if the order of the values
+of a producer is wrong.
+
+On the command line:
+
+    bench_mwmr [--producers N] [--points N] [--batch N] [--buf-size N]
+
+*/
+
+
+static const char* SHM_NAME="THE_BENCH_MEMORY_SEGMENT";
+
+static unsigned int n_producers=4;
+static uint64_t     n_points=2000000;     // per producer
+static size_t       batch=100;
+static uint64_t     buf_size=1000000;     // of the mwmr ring buffer, and of each swmr one
+
+typedef uint64_t value_t;
+
+static value_t make_value(unsigned int producer,uint64_t k) { return (value_t(producer)<<48) | k; }
+
+
+/**
+ * Checks the values received and counts them
+ */
+class checker {
+public:
+    checker() : last(n_producers,-1) {}
+
+    void check(const value_t* values,size_t n)
+    {
+        for (size_t k=0;k<n;k++) {
+            unsigned int producer=values[k]>>48;
+            int64_t      counter=values[k] & ((1ULL<<48)-1);
+            if (producer>=n_producers || counter<=last[producer])
+                order_ok=false;
+            else
+                last[producer]=counter;
+        }
+        received+=n;
+    }
+
+    bool     order_ok=true;
+    uint64_t received=0;
+
+private:
+    vector<int64_t> last;
+};
+
+
+/**
+ * Writes the values of producer 'p' with 'write(values,n)'
+ */
+template <typename W>
+void produce(unsigned int p,W write)
+{
+    vector<value_t> values(batch);
+    for (uint64_t k=0;k<n_points;k+=batch) {
+        size_t n=(n_points-k<batch)? n_points-k : batch;
+        for (size_t i=0;i<n;i++)
+            values[i]=make_value(p,k+i);
+        write(values.data(),n);
+    }
+}
+
+
+/**
+ * Forks the producers, running 'producer(p)' in each of them
+ */
+template <typename P>
+vector<pid_t> fork_producers(P producer)
+{
+    vector<pid_t> pids;
+    for (unsigned int p=0;p<n_producers;p++) {
+        pid_t pid=fork();
+        if (pid==-1) {
+            perror("ERROR: fork fails");
+            exit(-1);
+        }
+        if (pid==0) {
+            producer(p);
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    return pids;
+}
+
+static bool all_exited(vector<pid_t>& pids)
+{
+    for (auto &pid : pids) {
+        if (pid!=0 && waitpid(pid,NULL,WNOHANG)==pid)
+            pid=0;
+        if (pid!=0)
+            return false;
+    }
+    return true;
+}
+
+static void report(const char* what,const checker& chk,chrono::steady_clock::time_point t0)
+{
+    double sec=chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+    uint64_t total=n_producers*n_points;
+    cout << left << setw(22) << what << right << fixed << setprecision(3)
+         << setw(8) << sec << " s " << setw(8) << setprecision(1) << chk.received/sec/1e6 << " Mpoints/s   lost "
+         << total-chk.received << " of " << total << (chk.order_ok? "" : "   ORDER ERROR") << endl;
+}
+
+
+bool bench_mwmr()
+{
+    const char *name="BENCH_MWMR";
+    shared_memory_object::remove(SHM_NAME);
+    managed_shared_memory segment(create_only,SHM_NAME,mwmr_ringbuffer<value_t>::get_shm_size(buf_size,1)+4096);
+    mwmr_ringbuffer<value_t>::construct(name,segment,buf_size,1);
+    checker chk;
+    {
+        mwmr_ringbuffer<value_t> ring(name,segment);
+        size_t reader=ring.attach_reader();
+
+        auto t0=chrono::steady_clock::now();
+        auto pids=fork_producers([&](unsigned int p) {
+            mwmr_ringbuffer<value_t> ring(name,segment);
+            produce(p,[&](const value_t* v,size_t n) { ring.write(v,n); });
+        });
+
+        vector<value_t> values(batch*n_producers);
+        while (true) {
+            bool done=all_exited(pids);
+            size_t n=ring.read_wait(reader,values.data(),1,values.size(),1);
+            chk.check(values.data(),n);
+            if (n==0 && done)
+                break;
+        }
+        report("mwmr: one ring",chk,t0);
+    }
+    shared_memory_object::remove(SHM_NAME);
+    return chk.order_ok;
+}
+
+
+bool bench_swmr()
+{
+    typedef swmr_ringbuffer<value_t,swmr_sync::lock_free> ring_t;
+    vector<string> names;
+    for (unsigned int p=0;p<n_producers;p++)
+        names.push_back("BENCH_SWMR_"+to_string(p));
+
+    shared_memory_object::remove(SHM_NAME);
+    managed_shared_memory segment(create_only,SHM_NAME,n_producers*(ring_t::get_shm_size(buf_size,1)+4096));
+    for (auto &name : names) {
+        ring_t::remove(name.c_str());
+        ring_t::construct(name.c_str(),segment,buf_size,1);
+    }
+    checker chk;
+    {
+        vector<unique_ptr<ring_t>> rings;
+        for (auto &name : names) {
+            rings.emplace_back(new ring_t(name.c_str(),segment));
+            rings.back()->attach_reader();
+        }
+
+        auto t0=chrono::steady_clock::now();
+        auto pids=fork_producers([&](unsigned int p) {
+            ring_t ring(names[p].c_str(),segment);
+            produce(p,[&](const value_t* v,size_t n) { ring.write(v,n); });
+        });
+
+        // Read from all the rings in turn, waiting on the next one when all are empty
+        vector<value_t> values(batch*n_producers);
+        size_t next=0;
+        while (true) {
+            bool done=all_exited(pids);
+            size_t n_total=0;
+            for (auto &ring : rings) {
+                size_t n=ring->read(0,values.data(),values.size());
+                chk.check(values.data(),n);
+                n_total+=n;
+            }
+            if (n_total==0) {
+                if (done)
+                    break;
+                rings[next]->wait_available(0,1,1);
+                next=(next+1)%rings.size();
+            }
+        }
+        report("swmr: one ring each",chk,t0);
+    }
+    for (auto &name : names)
+        ring_t::remove(name.c_str(),segment);
+    shared_memory_object::remove(SHM_NAME);
+    return chk.order_ok;
+}
+
+
+int main(int argc,char * argv[])
+{
+    for (int k=1;k<argc;k++) {
+        if (strcmp(argv[k],"--producers")==0 && k+1<argc)
+            n_producers=atoi(argv[++k]);
+        else if (strcmp(argv[k],"--points")==0 && k+1<argc)
+            n_points=atoll(argv[++k]);
+        else if (strcmp(argv[k],"--batch")==0 && k+1<argc)
+            batch=atoi(argv[++k]);
+        else if (strcmp(argv[k],"--buf-size")==0 && k+1<argc)
+            buf_size=atoll(argv[++k]);
+        else {
+            cerr << "ERROR: unknown option " << argv[k] << endl;
+            return -1;
+        }
+    }
+    if (n_producers==0 || n_producers>=(1<<16) || batch==0 || buf_size==0) {
+        cerr << "ERROR: invalid parameters" << endl;
+        return -1;
+    }
+
+    cout << n_producers << " producers x " << n_points << " points, writes of " << batch
+         << " points, buffers of " << buf_size << " points" << endl;
+    bool ok=bench_mwmr();
+    ok=bench_swmr() && ok;
+    return ok? 0 : -1;
+}
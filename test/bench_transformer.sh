@@ -0,0 +1,20 @@
+# Benchmark of the transformer: throughput with the stages transforming in the main
+# thread, then with 1, 2, 4 and 8 workers ('--workers').
+# For each run the input ring buffer is filled first by the generator
+# ('--max-rate'), then the transformer reads it alone, so it is only limited by
+# the transform stages.
+
+# Points per run, and the stages (by default a 32 taps FIR filter and a
+# conversion, heavy enough to need more than one core at full rate)
+POINTS=${POINTS:-10000000}
+TAPS=$(for k in $(seq 32); do printf "0.03125,"; done)
+STAGES=${STAGES:-"--stage fir:${TAPS%,} --stage convert:int16,1000"}
+BLOCK=${BLOCK:-16384}
+
+
+for W in 0 1 2 4 8; do
+    obj/setup --buf-size $POINTS
+    obj/generator --quiet --max-rate --seconds 1 --rate $POINTS >/dev/null
+    obj/transformer --inbuf RING_BUFFER1 --outbuf RING_BUFFER2 --seconds 1 --rate $POINTS --workers $W --block $BLOCK $STAGES
+    obj/setup --remove
+done
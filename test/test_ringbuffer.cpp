@@ -1,5 +1,9 @@
 #include <unistd.h>
+#include <sys/wait.h>
+#include <cstring>
 #include <iostream>
+#include <thread>
+#include <chrono>
 #include "swmr_ringbuffer.h"
 
 using namespace boost::interprocess;
@@ -9,8 +13,13 @@ using namespace std;
 
 Code to test the swmr_ringbuffer data structure.
 
-Runs a 'one writer'/'two readers' test. The writer writes a sequence of integers
-in the ring buffer (length of sequence bigger than the ring buffer size to verify wrap-around).
+First runs a few deterministic checks in a single process (e.g. that a reader that
+has been overrun resumes reading from the oldest data still in the buffer, and that
+the counters account for the lost data).
+
+Then runs a 'one writer'/'two readers' test. The writer writes a sequence of integers
+(one at a time, and then with a producer) in the ring buffer (length of sequence bigger than the ring buffer size to verify wrap-around).
+The writer paces itself so that it never overruns the readers.
 
 The readers read the sequence and verify for the values to be in the correct increasing order.
 
@@ -19,8 +28,21 @@ If the test is succesful, the following messages are printed (in a random order)
   Reader o: all reads completed
   Reader 1: all reads completed
 
-Uses fork() twice to spawn the two readers processes.
+Uses fork() twice to spawn the two readers processes, and waits for them to finish.
+The exit status is non zero if any of the checks or of the readers fails.
+
+On the command line:
+
+    test_ringbuffer [--lock-free] [--hugetlbfs DIR] [--numa-node N] [--prefault] [--lock]
+
+        --lock-free     : test the swmr_sync::lock_free policy instead of the
+                          default swmr_sync::locked
+        --hugetlbfs DIR : store the data of the ring buffer in a file in DIR
+        --numa-node N   : bind the data of the ring buffer to NUMA node N
+        --prefault      : allocate and map all the pages in advance
+        --lock          : lock the data in RAM in the writer and readers
 
+The backing of the ring buffer in use is printed at the start of the test.
 */
 
 
@@ -35,32 +57,454 @@ static const size_t NUM_WRITES=100000; // We write this many points in the buffe
 static const size_t MAX_READERS=3;
 
 
-typedef swmr_ringbuffer<int,BUF_SIZE,MAX_READERS> ringbuf_t; // Just a shorthand
+// For the single-process checks: a small buffer in its own segment
+static const char* CHECK_SHM_NAME="THE_TEST_CHECK_SEGMENT";
+
+static const size_t CHECK_BUF_SIZE=10;
+
+
+// Placement of the data of the ring buffer (from the command line)
+static swmr_memory_options memory;
+
+
+// Just a shorthand
+template <swmr_sync SYNC> using ringbuf_t=swmr_ringbuffer<int,SYNC>;
 
 
 /**
  * Creates the shared memory data structures.
  */
+template <swmr_sync SYNC>
 void init()
 {
     // Remove first in case left from previous abort
-    ringbuf_t::remove(RINGBUF_NAME);
+    ringbuf_t<SYNC>::remove(RINGBUF_NAME);
     shared_memory_object::remove(SHM_NAME);
 
     // Create
-    managed_shared_memory* shm_segment=new managed_shared_memory(create_only, SHM_NAME, ringbuf_t::get_shm_size()+400);
-    ringbuf_t::construct(RINGBUF_NAME,*shm_segment);
+    managed_shared_memory* shm_segment=new managed_shared_memory(create_only, SHM_NAME, ringbuf_t<SYNC>::get_shm_size(BUF_SIZE,MAX_READERS,memory)+400);
+    ringbuf_t<SYNC>::construct(RINGBUF_NAME,*shm_segment,BUF_SIZE,MAX_READERS,swmr_overflow::overwrite,memory);
+    cout << "Ring buffer backing: " << ringbuf_t<SYNC>(RINGBUF_NAME,*shm_segment).backing() << endl;
+
+    // Attaching with the wrong element type must fail
+    try {
+        swmr_ringbuffer<double,SYNC> wrong_buf(RINGBUF_NAME,*shm_segment);
+        cerr << "ERROR: ring buffer of 'int' attached as 'double'" << endl;
+        exit(-1);
+    } catch (std::runtime_error &) {
+    }
+}
+
+
+/**
+ * If 'ok' is false, prints an error message and terminates
+ */
+void check(bool ok,const char* what)
+{
+    if (!ok) {
+        cerr << "ERROR: check failed: " << what << endl;
+        exit(-1);
+    }
+}
+
+
+/**
+ * Writing more than the buffer size without reading: the reader must
+ * resume reading from the oldest data still in the buffer.
+ */
+template <swmr_sync SYNC>
+void check_overrun(managed_shared_memory& segment)
+{
+    const char *name="CHECK_OVERRUN";
+    ringbuf_t<SYNC>::remove(name);
+    ringbuf_t<SYNC>::construct(name,segment,CHECK_BUF_SIZE,1);
+    ringbuf_t<SYNC> buf(name,segment);
+    check(buf.attach_reader()==0,"attach the only reader");
+
+    // Write 0..24, in chunks of 5
+    int array[5];
+    for (int k=0;k<25;k+=5) {
+        for (int i=0;i<5;i++)
+            array[i]=k+i;
+        buf.write(array,5);
+    }
+    check(buf.read_available(0)==CHECK_BUF_SIZE,"overrun: available clipped at buffer size");
+
+    int read_buf[2*CHECK_BUF_SIZE];
+    check(buf.read(0,read_buf,2*CHECK_BUF_SIZE)==CHECK_BUF_SIZE,"overrun: read returns buffer size");
+    for (int k=0;k<CHECK_BUF_SIZE;k++)
+        check(read_buf[k]==15+k,"overrun: read resumes at write_seq-capacity");
+    check(buf.read_available(0)==0,"overrun: nothing left to read");
+
+    // The counters in shared memory must account for every element
+    swmr_stats st=buf.stats();
+    check(st.written==25 && st.writes==5,"overrun: writer counters");
+    check(st.readers[0].read==CHECK_BUF_SIZE && st.readers[0].lost==25-CHECK_BUF_SIZE,"overrun: reader counters");
+    check(st.readers[0].overruns>0 && st.readers[0].max_lag==CHECK_BUF_SIZE,"overrun: reader overruns and max lag");
+    check(ringbuf_t<SYNC>::stats(name,segment).readers[0].lost==st.readers[0].lost,"overrun: counters without attaching");
+
+    ringbuf_t<SYNC>::remove(name);
+}
+
+
+/**
+ * Zero-copy reads: a region that wraps around the buffer bottom, the count of
+ * elements overwritten while the region is held and releasing too much.
+ */
+template <swmr_sync SYNC>
+void check_acquire(managed_shared_memory& segment)
+{
+    const char *name="CHECK_ACQUIRE";
+    ringbuf_t<SYNC>::remove(name);
+    ringbuf_t<SYNC>::construct(name,segment,CHECK_BUF_SIZE,1);
+    ringbuf_t<SYNC> buf(name,segment);
+    check(buf.attach_reader()==0,"attach the only reader");
+
+    // Write 0..7, read 0..5, then write 8..11 (wrapping around)
+    int array[CHECK_BUF_SIZE];
+    for (int k=0;k<8;k++)
+        array[k]=k;
+    buf.write(array,8);
+    check(buf.read(0,array,6)==6,"acquire: first read");
+    for (int k=0;k<4;k++)
+        array[k]=8+k;
+    buf.write(array,4);
+
+    // The region of 6..11 is split in 6..9 and 10..11
+    auto region=buf.acquire_read(0,100);
+    check(region.size()==6 && region.n1==4 && region.n2==2,"acquire: wrapped region split");
+    for (size_t k=0;k<region.size();k++) {
+        size_t n_contig;
+        const int *x=region.at(k,n_contig);
+        check(*x==int(6+k),"acquire: region data");
+        check(n_contig==((k<4)? 4-k : 6-k),"acquire: contiguous elements in region");
+    }
+
+    // While the region is held, write 12..18: the writer overwrites 6, 7, 8
+    for (int k=0;k<7;k++)
+        array[k]=12+k;
+    buf.write(array,7);
+    check(buf.release_read(0,6)==3,"acquire: overwritten count");
+
+    // The next read starts after the released region
+    check(buf.read(0,array,1)==1 && array[0]==12,"acquire: read after release");
+
+    // Cannot release more than acquired
+    region=buf.acquire_read(0,2);
+    check(region.size()==2,"acquire: second region");
+    try {
+        buf.release_read(0,3);
+        check(false,"acquire: releasing more than acquired must throw");
+    } catch (std::invalid_argument &) {
+    }
+    check(buf.release_read(0,2)==0,"acquire: release after failed release");
+
+    ringbuf_t<SYNC>::remove(name);
+}
+
+
+/**
+ * Zero-copy writes: a region that wraps around the buffer bottom, committing
+ * less than reserved and committing too much.
+ */
+template <swmr_sync SYNC>
+void check_reserve(managed_shared_memory& segment)
+{
+    const char *name="CHECK_RESERVE";
+    ringbuf_t<SYNC>::remove(name);
+    ringbuf_t<SYNC>::construct(name,segment,CHECK_BUF_SIZE,1);
+    ringbuf_t<SYNC> buf(name,segment);
+    check(buf.attach_reader()==0,"attach the only reader");
+
+    // Write and read 0..6
+    int array[CHECK_BUF_SIZE];
+    for (int k=0;k<7;k++)
+        array[k]=k;
+    buf.write(array,7);
+    check(buf.read(0,array,7)==7,"reserve: first read");
+
+    // Reserve 7..12: split in 7..9 and 10..12
+    auto region=buf.reserve_write(6);
+    check(region.size()==6 && region.n1==3 && region.n2==3,"reserve: wrapped region split");
+    for (size_t k=0;k<region.size();k++) {
+        size_t n_contig;
+        *region.at(k,n_contig)=7+k;
+    }
+    check(buf.read_available(0)==0,"reserve: nothing visible before commit");
+    try {
+        buf.commit_write(7);
+        check(false,"reserve: committing more than reserved must throw");
+    } catch (std::invalid_argument &) {
+    }
+    buf.commit_write(6);
+    check(buf.read(0,array,CHECK_BUF_SIZE)==6,"reserve: read after commit");
+    for (int k=0;k<6;k++)
+        check(array[k]==7+k,"reserve: data after commit");
+
+    // Commit less than reserved
+    region=buf.reserve_write(4);
+    size_t n_contig;
+    *region.at(0,n_contig)=13;
+    *region.at(1,n_contig)=14;
+    buf.commit_write(2);
+    check(buf.read(0,array,CHECK_BUF_SIZE)==2 && array[0]==13 && array[1]==14,"reserve: partial commit");
+
+    ringbuf_t<SYNC>::remove(name);
+}
+
+
+/**
+ * Blocking reads: a wait times out returning what is available, and the
+ * writer wakes up the reader only when the low watermark is reached.
+ */
+template <swmr_sync SYNC>
+void check_wait(managed_shared_memory& segment)
+{
+    typedef std::chrono::steady_clock clock;
+    auto msec_since = [](clock::time_point t0) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now()-t0).count();
+    };
+
+    const char *name="CHECK_WAIT";
+    ringbuf_t<SYNC>::remove(name);
+    ringbuf_t<SYNC>::construct(name,segment,CHECK_BUF_SIZE,1);
+    ringbuf_t<SYNC> buf(name,segment);
+    check(buf.attach_reader()==0,"attach the only reader");
+    int array[CHECK_BUF_SIZE];
+
+    // Nothing to read: returns nothing after the timeout
+    auto t0=clock::now();
+    check(buf.read_wait(0,array,1,CHECK_BUF_SIZE,100)==0,"wait: timeout with no data");
+    check(msec_since(t0)>=90,"wait: timeout duration");
+
+    // Less than the watermark: returns what is available after the timeout
+    for (int k=0;k<2;k++)
+        array[k]=k;
+    buf.write(array,2);
+    t0=clock::now();
+    check(buf.wait_available(0,3,100)==2,"wait: timeout with data below watermark");
+    check(msec_since(t0)>=90,"wait: timeout duration with data below watermark");
+    check(buf.read(0,array,CHECK_BUF_SIZE)==2,"wait: read data below watermark");
+
+    // The writer writes 1 element (below the watermark of 3), then 2 more:
+    // the reader must get all 3 when the second write crosses the watermark,
+    // well before the timeout
+    std::thread writer_thread([&buf] {
+        int x[2]={2,3};
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        buf.write(x,1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        buf.write(x+1,1);
+        buf.write(x+1,1);
+    });
+    t0=clock::now();
+    size_t n=buf.read_wait(0,array,3,CHECK_BUF_SIZE,5000);
+    long msec=msec_since(t0);
+    writer_thread.join();
+    check(n==3,"wait: woken up at the watermark");
+    check(msec>=140 && msec<2000,"wait: woken up by the writer, not by the timeout");
+
+    ringbuf_t<SYNC>::remove(name);
+}
+
+
+/**
+ * Attaching and detaching readers: leased identifiers, where a reader starts,
+ * and reclaiming the identifier of a process that died without detaching.
+ */
+template <swmr_sync SYNC>
+void check_attach(managed_shared_memory& segment)
+{
+    const char *name="CHECK_ATTACH";
+    ringbuf_t<SYNC>::remove(name);
+    ringbuf_t<SYNC>::construct(name,segment,CHECK_BUF_SIZE,2);
+    ringbuf_t<SYNC> buf(name,segment);
+
+    check(buf.attach_reader()==0 && buf.attach_reader()==1,"attach: leased identifiers");
+    try {
+        buf.attach_reader();
+        check(false,"attach: attaching more than max readers must throw");
+    } catch (std::runtime_error &) {
+    }
+    try {
+        buf.attach_reader(0);
+        check(false,"attach: attaching a reader in use must throw");
+    } catch (std::runtime_error &) {
+    }
+
+    // A reader attached at the head only sees what is written afterwards
+    int array[3]={0,1,2};
+    buf.write(array,3);
+    buf.detach_reader(1);
+    check(buf.stats().readers[1].active==false,"attach: detached reader not active");
+    check(buf.attach_reader(swmr_start::head)==1,"attach: reuse of detached identifier");
+    check(buf.read_available(0)==3 && buf.read_available(1)==0,"attach: start at head");
+    buf.detach_reader(1);
+    buf.attach_reader(1,swmr_start::oldest);
+    check(buf.read_available(1)==3,"attach: start at oldest");
+    buf.detach_reader(1);
+
+    // A process that dies without detaching: its identifier is reclaimed
+    pid_t pid=fork();
+    if (pid==0) {
+        ringbuf_t<SYNC> child_buf(name,segment);
+        _exit(child_buf.attach_reader()==1? 0 : 1);
+    }
+    int status;
+    check(pid!=-1 && waitpid(pid,&status,0)==pid && WIFEXITED(status) && WEXITSTATUS(status)==0,"attach: child process");
+    swmr_stats st=buf.stats();
+    check(st.readers[1].active && st.readers[1].pid==uint32_t(pid),"attach: reader of dead process still active");
+    check(buf.attach_reader()==1,"attach: identifier of dead process reclaimed");
+    check(buf.stats().readers[1].pid==uint32_t(getpid()),"attach: reclaimed by this process");
+
+    ringbuf_t<SYNC>::remove(name);
+}
+
+
+/**
+ * Critical readers: with swmr_overflow::block the writer waits for them (but not for
+ * the best effort readers, nor for a critical reader whose process has died), with
+ * swmr_overflow::drop_newest it writes only what fits.
+ */
+template <swmr_sync SYNC>
+void check_overflow(managed_shared_memory& segment)
+{
+    const char *name="CHECK_BLOCK";
+    ringbuf_t<SYNC>::remove(name);
+    ringbuf_t<SYNC>::construct(name,segment,CHECK_BUF_SIZE,3,swmr_overflow::block);
+    {
+        ringbuf_t<SYNC> buf(name,segment);
+        check(buf.attach_reader(swmr_start::oldest,true)==0,"block: attach critical reader");
+        check(buf.attach_reader(swmr_start::oldest,false)==1,"block: attach best effort reader");
+
+        int array[CHECK_BUF_SIZE]={0};
+        check(buf.write(array,CHECK_BUF_SIZE)==CHECK_BUF_SIZE,"block: fill the buffer");
+
+        // The writer must wait until the critical reader has read 3 elements
+        std::atomic<bool> written(false);
+        std::thread writer_thread([&] {
+            int x[3]={10,11,12};
+            buf.write(x,3);
+            written=true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        check(!written,"block: writer waits for the critical reader");
+        check(buf.read(0,array,3)==3,"block: critical reader makes space");
+        writer_thread.join();
+        check(written,"block: writer resumes");
+        check(buf.read_available(0)==CHECK_BUF_SIZE,"block: nothing lost for the critical reader");
+        check(buf.read(1,array,CHECK_BUF_SIZE)==CHECK_BUF_SIZE && array[0]==0 && array[CHECK_BUF_SIZE-1]==12,
+              "block: best effort reader loses the oldest data");
+        check(buf.stats().blocked_ns>0,"block: blocked time counted");
+        buf.detach_reader(0);
+        buf.detach_reader(1);
+
+        // A critical reader whose process has died does not block the writer forever
+        pid_t pid=fork();
+        if (pid==0) {
+            ringbuf_t<SYNC> child_buf(name,segment);
+            child_buf.attach_reader(swmr_start::head,true);
+            _exit(0);
+        }
+        int status;
+        check(pid!=-1 && waitpid(pid,&status,0)==pid,"block: child process");
+        check(buf.write(array,CHECK_BUF_SIZE)==CHECK_BUF_SIZE && buf.write(array,1)==1,"block: dead critical reader ignored");
+    }
+    ringbuf_t<SYNC>::remove(name,segment);
+
+    name="CHECK_DROP";
+    ringbuf_t<SYNC>::remove(name);
+    ringbuf_t<SYNC>::construct(name,segment,CHECK_BUF_SIZE,1,swmr_overflow::drop_newest);
+    {
+        ringbuf_t<SYNC> buf(name,segment);
+        buf.attach_reader(swmr_start::oldest,true);
+
+        int array[CHECK_BUF_SIZE];
+        for (int k=0;k<CHECK_BUF_SIZE;k++)
+            array[k]=k;
+        check(buf.write(array,CHECK_BUF_SIZE)==CHECK_BUF_SIZE,"drop: fill the buffer");
+        check(buf.write(array,5)==0,"drop: nothing written when full");
+        check(buf.read(0,array,3)==3 && array[0]==0,"drop: oldest data kept");
+        check(buf.write(array,5)==3,"drop: only what fits is written");
+        check(buf.stats().dropped==7,"drop: dropped count");
+    }
+    ringbuf_t<SYNC>::remove(name,segment);
+}
+
+
+/**
+ * Producer: the elements become visible when the batch is full, when the
+ * latency expires or when flushing explicitly.
+ */
+template <swmr_sync SYNC>
+void check_producer(managed_shared_memory& segment)
+{
+    const char *name="CHECK_PRODUCER";
+    ringbuf_t<SYNC>::remove(name);
+    ringbuf_t<SYNC>::construct(name,segment,CHECK_BUF_SIZE,1);
+    {
+        ringbuf_t<SYNC> buf(name,segment);
+        check(buf.attach_reader()==0,"attach the only reader");
+        int array[CHECK_BUF_SIZE];
+        {
+            typename ringbuf_t<SYNC>::producer prod(buf,4,50000);
+            for (int k=0;k<3;k++)
+                prod.push(k);
+            check(buf.read_available(0)==0 && prod.pending()==3,"producer: batch not written before full");
+            prod.push(3);
+            check(buf.read_available(0)==4 && prod.pending()==0,"producer: batch written when full");
+            check(buf.stats().writes==1,"producer: one write per batch");
+
+            prod.push(4);
+            check(!prod.flush_if_due(),"producer: no flush before the latency");
+            std::this_thread::sleep_for(std::chrono::milliseconds(60));
+            check(prod.flush_if_due() && buf.read_available(0)==5,"producer: flush after the latency");
+
+            prod.push(5);
+            check(prod.flush()==1 && buf.read_available(0)==6,"producer: explicit flush");
+            prod.push(6);
+        }
+        check(buf.read(0,array,CHECK_BUF_SIZE)==7,"producer: flush when destroyed");
+        for (int k=0;k<7;k++)
+            check(array[k]==k,"producer: data");
+    }
+    ringbuf_t<SYNC>::remove(name,segment);
+}
+
+
+/**
+ * Runs all the single-process checks.
+ */
+template <swmr_sync SYNC>
+void run_checks()
+{
+    shared_memory_object::remove(CHECK_SHM_NAME);
+    {
+        managed_shared_memory segment(create_only, CHECK_SHM_NAME, 8*ringbuf_t<SYNC>::get_shm_size(CHECK_BUF_SIZE,2)+4096);
+        check_overrun<SYNC>(segment);
+        check_acquire<SYNC>(segment);
+        check_reserve<SYNC>(segment);
+        check_wait<SYNC>(segment);
+        check_attach<SYNC>(segment);
+        check_overflow<SYNC>(segment);
+        check_producer<SYNC>(segment);
+    }
+    shared_memory_object::remove(CHECK_SHM_NAME);
+    cout << "All single-process checks passed" << endl;
 }
 
 
 /**
  * Just writes a series of incrementing integers.
+ * Waits (polling) when one of the readers is too far behind, so that
+ * no data is lost.
  */
+template <swmr_sync SYNC>
 void writer()
 {
     // Open shared memeory buffer
     managed_shared_memory segment(open_only, SHM_NAME);
-    ringbuf_t buf(RINGBUF_NAME,segment);
+    ringbuf_t<SYNC> buf(RINGBUF_NAME,segment);
 
     // First do a 'array' write...
     const size_t N_ARRAY=77;
@@ -70,32 +514,63 @@ void writer()
 
     buf.write(array,N_ARRAY);
 
-    // ... Then a sequence of single element writes
-    for (int k=N_ARRAY;k<NUM_WRITES;k++)
+    // ... Then a sequence of single element writes, first one by one...
+    const size_t N_SINGLE=NUM_WRITES/2;
+    for (int k=N_ARRAY;k<N_SINGLE;k++) {
+        while (buf.read_available(0)>=BUF_SIZE || buf.read_available(1)>=BUF_SIZE)
+            usleep(10);
         buf.write(k);
+    }
+
+    // ... and then collected in batches by a producer. The batch is written at
+    // once, so we wait for the space for a whole batch.
+    const size_t BATCH_SIZE=64;
+    typename ringbuf_t<SYNC>::producer prod(buf,BATCH_SIZE,1000);
+    for (int k=N_SINGLE;k<NUM_WRITES;k++) {
+        while (buf.read_available(0)+BATCH_SIZE>BUF_SIZE || buf.read_available(1)+BATCH_SIZE>BUF_SIZE) {
+            prod.flush_if_due();
+            usleep(10);
+        }
+        prod.push(k);
+    }
 }
 
 
 /**
  * Just reads NUM_WRITES integer from the buffer using 'reader_id'
  * and checks they are in incrementing order, starting at 0.
- * In case of an error, prints a message on stderr and terminates
+ * Reader 1 uses the zero-copy acquire_read()/release_read().
+ * In case of an error, prints a message on stderr and terminates (exit status -1).
  * If all values are read succesfully, prints:
  *   Reader X: all reads completed
  */
+template <swmr_sync SYNC>
 void reader(size_t reader_id)
 {
     // Open shared memeory buffer
     managed_shared_memory segment(open_only, SHM_NAME);
-    ringbuf_t buf(RINGBUF_NAME,segment);
+    ringbuf_t<SYNC> buf(RINGBUF_NAME,segment);
+    buf.attach_reader(reader_id);
 
 
     for (int k=0;k<NUM_WRITES;k++) {
         int x;
 
-        // if nothing to read,wait a bit and retry
-        while (buf.read(reader_id,&x,1)!=1)
-            usleep(10);
+        // if nothing to read, wait for the writer to wake us up and retry.
+        // Reader 1 uses the zero-copy interface, the others a normal read
+        if (reader_id==1) {
+            swmr_region<const int> region;
+            while ((region=buf.acquire_read(reader_id,1)).size()!=1)
+                buf.wait_available(reader_id,1,100);
+            x=*region.data1;
+            if (buf.release_read(reader_id,1)!=0) {
+                cerr << "ERROR: Reader " << reader_id << " data overwritten while reading " << k << endl;
+                exit(-1);
+            }
+        } else {
+            while (buf.read_wait(reader_id,&x,1,1,100)!=1)
+                ;
+        }
 
         if (x!=k) {
             cerr << "ERROR: Reader " << reader_id << " mismatch: " << x << "read instead of " << k << endl;
@@ -109,41 +584,77 @@ void reader(size_t reader_id)
 
 /**
  * Creates the data structures, spawns two children (the readers),
- * does the writing and cleans up.
+ * does the writing, waits for the readers and cleans up.
+ *
+ * @returns true if both readers have been succesful
  */
-int main(int argc,char * argv[])
+template <swmr_sync SYNC>
+bool run_test()
 {
-    init();
+    init<SYNC>();
 
-    switch (fork()) {
-        case -1:
-            perror("ERROR: fork [1] fails");
+    pid_t readers[2];
+    for (int k=0;k<2;k++) {
+        readers[k]=fork();
+        if (readers[k]==-1) {
+            perror("ERROR: fork fails");
             exit(-1);
-            break;
-        case 0:
+        }
+        if (readers[k]==0) {
             // Child
-            switch (fork()) {
-                case -1:
-                    perror("ERROR: fork [2] fails");
-                    exit(-1);
-                    break;
-                case 0:
-                    // grand child
-                    reader(0);
-                    break;
-                default:
-                    // the child
-                    reader(1);
-            }
-            break;
-        default:
-            writer();
+            reader<SYNC>(k);
+            exit(0);
+        }
+    }
+
+    writer<SYNC>();
+
+    bool ok=true;
+    for (auto pid : readers) {
+        int status;
+        if (waitpid(pid,&status,0)==-1 || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+            ok=false;
     }
 
-    // Wait a bit to make sure the readers have finished before deleting the
-    // shared memory structures.
-    // Not really correct, should do a proper rendez-vous with the children.
-    sleep(3);
-    ringbuf_t::remove(RINGBUF_NAME);
+    {
+        managed_shared_memory segment(open_only, SHM_NAME);
+        ringbuf_t<SYNC>::remove(RINGBUF_NAME,segment);
+    }
     shared_memory_object::remove(SHM_NAME);
-}
\ No newline at end of file
+    return ok;
+}
+
+
+template <swmr_sync SYNC>
+int run_all()
+{
+    run_checks<SYNC>();
+    return run_test<SYNC>()? 0 : -1;
+}
+
+
+int main(int argc,char * argv[])
+{
+    bool lock_free=false;
+    for (int k=1;k<argc;k++) {
+        if (strcmp(argv[k],"--lock-free")==0)
+            lock_free=true;
+        else if (strcmp(argv[k],"--hugetlbfs")==0 && k+1<argc)
+            memory.hugetlbfs_dir=argv[++k];
+        else if (strcmp(argv[k],"--numa-node")==0 && k+1<argc)
+            memory.numa_node=atoi(argv[++k]);
+        else if (strcmp(argv[k],"--prefault")==0)
+            memory.prefault=true;
+        else if (strcmp(argv[k],"--lock")==0)
+            memory.lock=true;
+        else {
+            cerr << "ERROR: unknown option " << argv[k] << endl;
+            return -1;
+        }
+    }
+
+    if (lock_free)
+        return run_all<swmr_sync::lock_free>();
+    else
+        return run_all<swmr_sync::locked>();
+}
@@ -9,6 +9,8 @@
 #include "H5Cpp.h"
 
 #include "cmn.h"
+#include "h5_frame_reader.h"
+#include "transform_stages.h"
 
 
 using namespace std;
@@ -21,19 +23,75 @@ Opens a series of HDF5 files that have been generated in sequence, reads
 all the data points in them and verifies that the datapoints (in order)
 match the generating function 'generate()' in cmn.h (possibly modified
 by the 'transform()' function.
+The files can have any number of channels, in a 2-D dataset or in one dataset per
+channel: the frames are verified as the interleaved sequence.
+The generator computes the points with 'generate_batch()', so they are compared
+with a tolerance (GENERATE_BATCH_TOLERANCE in cmn.h by default).
+The data of a transformer run with other transform stages is verified by giving
+the same stages: the reference points go through them (see transform_stages.h).
 */
 
-bool do_transform=false;
+bool do_transform=false;       // the same as '--stage transform'
 bool quiet=false;
+double tolerance=GENERATE_BATCH_TOLERANCE;
+vector<string> stages;
+string stages_file;
+
+
+/**
+ * The reference points: the sequence of generate(), through the transform stages
+ * if any
+ */
+class reference {
+public:
+    /// Returns the next point
+    data_point_t next(size_t channels)
+    {
+        if (stages.empty() && stages_file.empty())
+            return generate(j++);
+
+        if (!pipeline) {
+            pipeline.reset(new transform_pipeline(channels));
+            for (auto &stage : stages)
+                pipeline->add(stage);
+            if (!stages_file.empty())
+                pipeline->add_file(stages_file);
+        }
+        // Generate the points one block of frames at a time, and keep the frames
+        // output
+        while (pos==points.size()) {
+            const size_t BLOCK_FRAMES=4096;
+            vector<data_point_t> in(BLOCK_FRAMES*channels);
+            for (size_t k=0;k<in.size();k++)
+                in[k]=generate(j++);
+            points.clear();
+            pos=0;
+            pipeline->process(in.data(),BLOCK_FRAMES,[&](const data_point_t* y,size_t m) {
+                points.insert(points.end(),y,y+m*channels);
+            });
+        }
+        return points[pos++];
+    }
+
+private:
+    size_t j=0;    // next point generated
+    unique_ptr<transform_pipeline> pipeline;
+    vector<data_point_t> points;
+    size_t pos=0;
+};
 
 /*
 On the command line:
 
-    verify_results [--transform]  [--quiet]  file ...
+    verify_results [--transform | --stage DESC ... | --stages FILE]  [--quiet]  [--tolerance X | --exact]  file ...
 
         file ...    : a list of the HDF5 file names
         --transform : apply the 'transform()' function
+        --stage     : apply this transform stage (in order, as the transformer)
+        --stages    : apply the transform stages in this file (after those of --stage)
         --quiet     : just print errors or successful result
+        --tolerance : max difference from the reference (default GENERATE_BATCH_TOLERANCE)
+        --exact     : the points must be equal to the reference (generator run with '--exact')
 */
 int main(int argc, char *argv[])
 {
@@ -46,64 +104,63 @@ int main(int argc, char *argv[])
            do_transform=true;
        else if (strcmp(argv[k],"--quiet")==0)
            quiet=true;
+       else if (strcmp(argv[k],"--tolerance")==0 && k+1<argc)
+           tolerance=atof(argv[++k]);
+       else if (strcmp(argv[k],"--exact")==0)
+           tolerance=0;
+       else if (strcmp(argv[k],"--stage")==0 && k+1<argc)
+           stages.push_back(argv[++k]);
+       else if (strcmp(argv[k],"--stages")==0 && k+1<argc)
+           stages_file=argv[++k];
        else
            filenames.push_back(argv[k]);
     }
+    if (do_transform && stages.empty() && stages_file.empty())
+        stages.push_back("transform");
 
     // The filenames end with a sequence number, so we sort them to have them
     // all in order
     sort(filenames.begin(),filenames.end());
 
     size_t mismatch_count=0;
+    reference ref;
 
 
     size_t j=0; // global index for all the points
     for (auto filename: filenames) {
 
         H5File file(H5std_string(filename), H5F_ACC_RDONLY);
-        DataSet dataset = file.openDataSet(H5std_string(DATASET_NAME));
-        DataSpace dataspace=dataset.getSpace();
-
-        vector<hsize_t> dims(dataspace.getSimpleExtentNdims());
-        dataspace.getSimpleExtentDims(&dims[0]);
-
-        size_t n_points=dims[0];
+        h5_frame_reader frames(file,DATASET_NAME);
+        size_t channels=frames.channels();
+        size_t n_frames=frames.frames();
 
         if (!quiet)
-            cout << filename << " " << n_points << " data points" << endl;
+            cout << filename << " " << n_frames << " frames of " << channels << " data points" << endl;
 
-        hsize_t offset[1]={0};
+        hsize_t offset=0;
 
         // Read the file data points ...
-        while (n_points) {
+        while (n_frames) {
 
-            // one 'membuf[]' chunk at a time
+            // one 'membuf[]' chunk at a time (at least a frame)
             const size_t MEMBUF_SIZE=65536;
-            data_point_t  membuf[MEMBUF_SIZE];
+            size_t max_frames=max<size_t>(MEMBUF_SIZE/channels,1);
+            vector<data_point_t> membuf(max_frames*channels);
 
-            // how many to read this time
-            size_t n = (n_points<MEMBUF_SIZE)? n_points : MEMBUF_SIZE;
+            // how many frames to read this time
+            size_t nf = (n_frames<max_frames)? n_frames : max_frames;
+            size_t n = nf*channels;
 
             // Read n data points
-            hsize_t memdim[1]={n};
-            hsize_t count[1]={n};
-            hsize_t stride[1]={1};
-            hsize_t block[1]={1};
-            DataSpace memspace(1, memdim);
-            dataspace.selectHyperslab(H5S_SELECT_SET, count, offset, stride, block);
-
-            dataset.read(membuf, PredType::NATIVE_DOUBLE,memspace,dataspace);
+            frames.read(offset,nf,membuf.data());
 
             // Verify if the points that have been read match with the reference
             for (int k=0;k<n;k++) {
                 data_point_t x     = membuf[k];
 
-                data_point_t x_ref = generate(j);
-
-                if (do_transform)
-                    x_ref = transform(j,x_ref);
+                data_point_t x_ref = ref.next(channels);
 
-                if (x!=x_ref) {
+                if (!(fabs(x-x_ref)<=tolerance)) {
                     static bool do_print=true;
                     mismatch_count++;
 
@@ -123,8 +180,8 @@ int main(int argc, char *argv[])
            }
 
 
-            offset[0] += n;
-            n_points  -= n;
+            offset   += nf;
+            n_frames -= nf;
 
         } // loop reading one file
 
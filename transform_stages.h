@@ -0,0 +1,412 @@
+#ifndef __TRANSFORM_STAGES
+#define __TRANSFORM_STAGES
+
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "cmn.h"
+
+
+/**
+ * A stage of a transform_pipeline: processes blocks of frames (one point per
+ * channel, interleaved) and outputs the same number of frames, or fewer (e.g. a
+ * decimation). A stage can keep state between blocks (e.g. the history of a filter).
+ *
+ * The parameters are fixed when the stage is built, so process() is a plain loop
+ * over the block the compiler can vectorize.
+ */
+class transform_stage {
+public:
+    virtual ~transform_stage() {}
+
+    /// Processes the 'n' frames in 'in', frame 'first' of the input of the stage,
+    /// and puts the result in 'out' (not the same as 'in'). Returns how many frames
+    /// are output
+    virtual size_t process(const double* in,size_t n,uint64_t first,double* out)=0;
+
+    /// One frame output every this many frames input
+    virtual size_t decimation() const { return 1; }
+
+    /// How many frames input before a frame its output depends on
+    virtual size_t history() const { return 0; }
+
+    /// Forgets the frames input so far
+    virtual void reset() {}
+};
+
+
+/**
+ * The transform() of cmn.h, with the index of the point in the sequence
+ */
+class cmn_transform_stage : public transform_stage {
+public:
+    cmn_transform_stage(unsigned int channels) : channels(channels) {}
+
+    size_t process(const double* in,size_t n,uint64_t first,double* out) override
+    {
+        uint64_t j0=first*channels;
+        for (size_t k=0;k<n*channels;k++)
+            out[k]=transform(j0+k,in[k]);
+        return n;
+    }
+
+private:
+    const unsigned int channels;
+};
+
+
+/**
+ * y = gain*x + offset, with a gain and an offset per channel
+ */
+class affine_stage : public transform_stage {
+public:
+    affine_stage(const std::vector<double>& gain,const std::vector<double>& offset) : gain(gain), offset(offset) {}
+
+    size_t process(const double* in,size_t n,uint64_t first,double* out) override
+    {
+        const size_t channels=gain.size();
+        if (channels==1) {
+            const double g=gain[0],o=offset[0];
+            for (size_t k=0;k<n;k++)
+                out[k]=g*in[k]+o;
+            return n;
+        }
+        for (size_t f=0;f<n;f++)
+            for (size_t c=0;c<channels;c++)
+                out[f*channels+c]=gain[c]*in[f*channels+c]+offset[c];
+        return n;
+    }
+
+private:
+    const std::vector<double> gain;
+    const std::vector<double> offset;
+};
+
+
+/**
+ * y = x limited to [lo,hi]
+ */
+class clip_stage : public transform_stage {
+public:
+    clip_stage(double lo,double hi,unsigned int channels) : lo(lo), hi(hi), channels(channels) {}
+
+    size_t process(const double* in,size_t n,uint64_t first,double* out) override
+    {
+        for (size_t k=0;k<n*channels;k++)
+            out[k]=std::min(std::max(in[k],lo),hi);
+        return n;
+    }
+
+private:
+    const double       lo,hi;
+    const unsigned int channels;
+};
+
+
+/**
+ * FIR filter of each channel: y[f] = sum(h[k]*x[f-k]). The last frames of a block
+ * are kept for the next one, so the blocks can be of any size.
+ */
+class fir_stage : public transform_stage {
+public:
+    fir_stage(const std::vector<double>& taps,unsigned int channels) :
+        taps(taps), channels(channels), past((taps.size()-1)*channels,0.0) {}
+
+    size_t process(const double* in,size_t n,uint64_t first,double* out) override
+    {
+        // The past frames followed by the block, so y[f] only reads from 'ext'
+        const size_t h_points=past.size();
+        ext.resize(h_points+n*channels);
+        std::copy(past.begin(),past.end(),ext.begin());
+        std::copy(in,in+n*channels,ext.begin()+h_points);
+
+        // One tap at a time over all the points of the block (all the channels
+        // together): each pass is a multiply-add of two contiguous arrays
+        const size_t n_points=n*channels;
+        std::fill(out,out+n_points,0.0);
+        for (size_t k=0;k<taps.size();k++) {
+            const double  h=taps[k];
+            const double *x=ext.data()+(taps.size()-1-k)*channels;
+            for (size_t i=0;i<n_points;i++)
+                out[i]+=h*x[i];
+        }
+
+        std::copy(ext.end()-h_points,ext.end(),past.begin());
+        return n;
+    }
+
+    size_t history() const override { return taps.size()-1; }
+    void reset() override { std::fill(past.begin(),past.end(),0.0); }
+
+private:
+    const std::vector<double> taps;
+    const unsigned int        channels;
+    std::vector<double>       past;        // the last taps-1 frames input
+    std::vector<double>       ext;
+};
+
+
+/**
+ * Keeps one frame every 'factor', the frames whose index is a multiple of 'factor'
+ * (usually after a low-pass FIR filter)
+ */
+class decimate_stage : public transform_stage {
+public:
+    decimate_stage(size_t factor,unsigned int channels) : factor(factor), channels(channels) {}
+
+    size_t process(const double* in,size_t n,uint64_t first,double* out) override
+    {
+        size_t f=(factor-first%factor)%factor;     // first frame kept
+        size_t m=0;
+        for (;f<n;f+=factor,m++)
+            std::copy(in+f*channels,in+(f+1)*channels,out+m*channels);
+        return m;
+    }
+
+    size_t decimation() const override { return factor; }
+
+private:
+    const size_t       factor;
+    const unsigned int channels;
+};
+
+
+/**
+ * Rounds the points as they would be stored with a smaller type: float32, or
+ * int16 after a scaling (saturated). The ring buffers carry doubles, so the points
+ * stay doubles, with the precision and range of the type.
+ */
+class convert_stage : public transform_stage {
+public:
+    enum class type { float32, int16 };
+
+    convert_stage(type to,double scale,unsigned int channels) : to(to), scale(scale), channels(channels) {}
+
+    size_t process(const double* in,size_t n,uint64_t first,double* out) override
+    {
+        const size_t n_points=n*channels;
+        if (to==type::float32) {
+            for (size_t k=0;k<n_points;k++)
+                out[k]=static_cast<float>(in[k]);
+        } else {
+            for (size_t k=0;k<n_points;k++)
+                out[k]=std::min(std::max(std::nearbyint(in[k]*scale),-32768.0),32767.0);
+        }
+        return n;
+    }
+
+private:
+    const type         to;
+    const double       scale;
+    const unsigned int channels;
+};
+
+
+/**
+ * A chain of transform stages, built from their descriptions (on the command line
+ * or in a file, one per line):
+ *
+ *     transform               the transform() of cmn.h
+ *     gain:G[,G...]           y = G*x (one G for all the channels, or one per channel)
+ *     offset:O[,O...]         y = x+O
+ *     clip:LO,HI              y = x limited to [LO,HI]
+ *     fir:H0,H1...            FIR filter of each channel
+ *     decimate:N              one frame every N
+ *     convert:float32         rounded to float
+ *     convert:int16[,SCALE]   rounded to int16 after multiplying by SCALE (default 1)
+ *
+ * The frames go through all the stages one tile at a time, small enough to stay
+ * in the cache between the stages.
+ *
+ * Decimating the input frames [a,b) outputs the frames from ceil(a/D) to ceil(b/D)
+ * with D the product of the decimations (see out_frames()), so the frames output
+ * only depend on the number of frames input, not on the blocks.
+ *
+ * A pipeline can also transform blocks of the stream out of order (e.g. each on
+ * a thread with a pipeline of its own): seek() to the start of the block less
+ * lookback() frames, and drop the frames output for those (see out_frames()). The
+ * frames output are then the same as those of one pipeline for the whole stream.
+ */
+class transform_pipeline {
+public:
+    /// Points per tile
+    static const size_t TILE_POINTS=4096;
+
+    transform_pipeline(unsigned int channels) : channels(channels)
+    {
+        size_t tile_frames=std::max<size_t>(TILE_POINTS/channels,1);
+        tile_a.resize(tile_frames*channels);
+        tile_b.resize(tile_frames*channels);
+    }
+
+    /// Adds a stage, from its description
+    void add(const std::string& desc)
+    {
+        size_t colon=desc.find(':');
+        std::string name=desc.substr(0,colon);
+        std::vector<std::string> params;
+        if (colon!=std::string::npos) {
+            std::istringstream in(desc.substr(colon+1));
+            std::string param;
+            while (std::getline(in,param,','))
+                params.push_back(param);
+        }
+
+        // The parameters from 'from' on, as numbers
+        auto numbers=[&](size_t from) {
+            std::vector<double> v;
+            for (size_t k=from;k<params.size();k++) {
+                char *end;
+                v.push_back(strtod(params[k].c_str(),&end));
+                if (params[k].empty() || *end!='\0')
+                    throw std::invalid_argument("transform stage "+desc+": invalid parameter "+params[k]);
+            }
+            return v;
+        };
+        auto per_channel=[&](std::vector<double> v) {
+            if (v.size()==1)
+                v.assign(channels,v[0]);
+            if (v.size()!=channels)
+                throw std::invalid_argument("transform stage "+desc+": need one value, or one per channel");
+            return v;
+        };
+
+        transform_stage *stage=nullptr;
+        if (name=="convert") {
+            std::string to=params.empty()? "" : params[0];
+            std::vector<double> args=numbers(1);
+            if (to=="float32" && args.empty())
+                stage=new convert_stage(convert_stage::type::float32,1,channels);
+            else if (to=="int16" && args.size()<=1)
+                stage=new convert_stage(convert_stage::type::int16,args.empty()? 1 : args[0],channels);
+        } else {
+            std::vector<double> args=numbers(0);
+            if (name=="transform" && args.empty())
+                stage=new cmn_transform_stage(channels);
+            else if (name=="gain" && !args.empty())
+                stage=new affine_stage(per_channel(args),std::vector<double>(channels,0.0));
+            else if (name=="offset" && !args.empty())
+                stage=new affine_stage(std::vector<double>(channels,1.0),per_channel(args));
+            else if (name=="clip" && args.size()==2 && args[0]<=args[1])
+                stage=new clip_stage(args[0],args[1],channels);
+            else if (name=="fir" && !args.empty())
+                stage=new fir_stage(args,channels);
+            else if (name=="decimate" && args.size()==1 && args[0]>=1 && args[0]==std::floor(args[0]))
+                stage=new decimate_stage(size_t(args[0]),channels);
+        }
+        if (!stage)
+            throw std::invalid_argument("transform stage "+desc+": unknown stage or wrong parameters");
+
+        stages.emplace_back(stage);
+        frames_in.push_back(0);
+    }
+
+    /// Adds the stages described in a file, one per line ('#' starts a comment)
+    void add_file(const std::string& file_name)
+    {
+        std::ifstream in(file_name);
+        if (!in)
+            throw std::invalid_argument("can't read "+file_name);
+        std::string line;
+        while (std::getline(in,line)) {
+            line=line.substr(0,line.find('#'));
+            line.erase(std::remove_if(line.begin(),line.end(),[](char c) { return isspace(c); }),line.end());
+            if (!line.empty())
+                add(line);
+        }
+    }
+
+    bool empty() const { return stages.empty(); }
+
+    /// Product of the decimations of the stages
+    size_t decimation() const
+    {
+        size_t d=1;
+        for (auto &s : stages)
+            d*=s->decimation();
+        return d;
+    }
+
+    /// Frames input so far
+    uint64_t input_frames() const { return frames_in.empty()? 0 : frames_in[0]; }
+
+    /// How many frames before a block must be input, so that the frames output for
+    /// the block don't depend on the frames before
+    size_t lookback() const
+    {
+        size_t n=0,d=1;
+        for (auto &s : stages) {
+            n+=(s->history()+1)*d;
+            d*=s->decimation();
+        }
+        return n;
+    }
+
+    /// Resets the stages, as if 'frame' frames had been input (with their effects
+    /// forgotten)
+    void seek(uint64_t frame)
+    {
+        uint64_t d=1;
+        for (size_t s=0;s<stages.size();s++) {
+            stages[s]->reset();
+            frames_in[s]=(frame+d-1)/d;
+            d*=stages[s]->decimation();
+        }
+    }
+
+    /// How many frames are output for the next 'n' frames input
+    size_t out_frames(size_t n) const { return out_frames(input_frames(),n); }
+
+    /// How many frames are output for the 'n' frames input from frame 'first'
+    size_t out_frames(uint64_t first,size_t n) const
+    {
+        uint64_t d=decimation();
+        return (first+n+d-1)/d-(first+d-1)/d;
+    }
+
+    /// The most frames that can be input next for at most 'n_out' frames output
+    uint64_t max_in_frames(size_t n_out) const
+    {
+        uint64_t d=decimation(),first=input_frames();
+        return ((first+d-1)/d+n_out)*d-first;
+    }
+
+    /**
+     * Transforms the 'n' frames of 'in', one tile at a time. The frames output
+     * are handed to 'put(const double* frames,size_t n_frames)' in order.
+     */
+    template <typename PUT> void process(const double* in,size_t n,PUT put)
+    {
+        size_t tile_frames=tile_a.size()/channels;
+        for (size_t f=0;f<n;f+=tile_frames) {
+            size_t       m=std::min(tile_frames,n-f);
+            const double *src=in+f*channels;
+            double       *dst=tile_a.data();
+            for (size_t s=0;s<stages.size() && m>0;s++) {
+                size_t out=stages[s]->process(src,m,frames_in[s],dst);
+                frames_in[s]+=m;
+                m=out;
+                src=dst;
+                dst=(dst==tile_a.data())? tile_b.data() : tile_a.data();
+            }
+            if (m>0)
+                put(src,m);
+        }
+    }
+
+private:
+    const unsigned int channels;
+    std::vector<std::unique_ptr<transform_stage>> stages;
+    std::vector<uint64_t> frames_in;      // frames input so far, in each stage
+    std::vector<double>   tile_a,tile_b;  // the output of the stages, in turn
+};
+
+#endif
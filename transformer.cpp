@@ -1,6 +1,13 @@
 #include <unistd.h>
 #include <string>
+#include <vector>
+#include <deque>
 #include <iostream>
+#include <algorithm>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <chrono>
 
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/variables_map.hpp>
@@ -9,8 +16,10 @@
 #include "H5Cpp.h"
 
 #include "cmn.h"
-
-#include "period_repeat.h"
+#include "transform_stages.h"
+#include "worker_pool.h"
+#include "period_scheduler.h"
+#include "drain_stats.h"
 
 
 using namespace std;
@@ -20,66 +29,327 @@ using namespace H5;
 // Transformer for the generator/transformer/reader example.
 // This process reads data points from the ring buffer named 'ringbuf_in_name',
 // transforms them and writes in the ring buffer 'ringbuf_out_name'
-// To evenly spread the CPU load, this wakes up every INTERVAL_MSEC
-// milliseconds and read the appropriate amount of data points to read POINTS_PER_SEC
-// points every seconds.
-
-
-/// How frequently to wake up to read the points
+// This is woken up by the writer of 'ringbuf_in_name' when at least 'batch_size'
+// points are available to read, or after 'max_latency_msec' milliseconds at most.
+// Each read takes all the points available, up to 'max_io_points' (up to a block,
+// with workers): after a stall it catches up with large reads, then goes back to
+// small ones (see drain_stats.h).
+// The points are read and written in whole frames (see CHANNELS_NAME).
+// The transformation is a chain of stages (gain, offset, FIR filter, decimation,
+// clipping, conversion... see transform_stages.h) given with '--stage' or in a
+// file with '--stages', by default the transform() of cmn.h.
+// With '--workers N' the blocks of frames read are transformed in parallel by N
+// threads, and written in order.
+// The transformer itself is run(), on the ring buffers of a segment: main() runs it
+// on the shared memory segment, the launcher on a heap segment (see launcher.cpp).
+
+
+/// Default max time to wait for data (msec)
 static const unsigned int INTERVAL_MSEC=40;
 
-/// How many points max to read every time
+/// How many points are written in an interval, by default
 static const unsigned int POINTS_PER_INTERVAL=(POINTS_PER_SEC/1000)*INTERVAL_MSEC;
 
+/// Default max points per read (when behind)
+static const unsigned int MAX_IO_POINTS=8*POINTS_PER_INTERVAL;
+
 
 //------------- Modified with the command line arguments --------
 unsigned int seconds_to_run=600;
+unsigned int points_per_sec=POINTS_PER_SEC;     // rate of the generator (frames)
 unsigned int reader_id=0;
+bool any_reader_id=true;                // if no Id is given, the first free one is used
+swmr_start start=swmr_start::oldest;    // where to start reading
+bool critical=false;                    // if the writer must not overwrite our data
 string ringbuf_in_name,ringbuf_out_name;
+unsigned int batch_size=POINTS_PER_INTERVAL;    // How many points to wait for before waking up
+unsigned int max_latency_msec=INTERVAL_MSEC;    // Max time to wait for 'batch_size' points
+size_t max_io_points=MAX_IO_POINTS;     // Max points per read, without workers
+vector<string> stages;          // The transform stages, in order
+string stages_file;             // A file with more stages (after those of 'stages')
+unsigned int n_workers=0;       // Threads transforming the blocks (0: all in the main thread)
+size_t block_frames=16384;      // Max frames per block, with workers
+bool quiet=false;
+int fifo_priority=0;    // SCHED_FIFO priority (0: normal scheduling)
+vector<int> cpus;       // cpus to run on (empty: any)
 
 void parse_args(int argc,char *argv[]);
 
+// Set to stop before 'seconds_to_run' (by the launcher)
+static atomic<bool> stop_requested(false);
 
-int main(int argc, char *argv[])
+
+/**
+ * Builds the pipeline of the transform stages chosen
+ */
+static void build_pipeline(transform_pipeline& pipeline)
 {
-    parse_args(argc,argv);
+    for (auto &stage : stages)
+        pipeline.add(stage);
+    if (!stages_file.empty())
+        pipeline.add_file(stages_file);
+    if (pipeline.empty())
+        pipeline.add("transform");
+}
 
-    // Setup for the ring buffers, which must have been ALREDAY CREATED (this
-    // just opens them)
-    interprocess::managed_shared_memory segment(interprocess::open_only, SHARED_MEM_NAME);
-    shm_ringbuf  buf_in(ringbuf_in_name.c_str(),segment);
-    shm_ringbuf  buf_out(ringbuf_out_name.c_str(),segment);
 
+/**
+ * Transforms the frames of 'buf_in' into 'buf_out' in this thread, directly from
+ * one ring buffer to the other. Returns the points read.
+ */
+static size_t run_serial(shm_ringbuf& buf_in,shm_ringbuf& buf_out,size_t channels,drain_stats& drain)
+{
+    transform_pipeline pipeline(channels);
+    build_pipeline(pipeline);
 
     size_t j=0;   // counter for read/written points
+    size_t total_points=size_t(seconds_to_run)*points_per_sec*channels;
+
+    while (j < total_points && !stop_requested) { // j < (Total points to generate) ?
+        // Wait until there is a batch of points to read (or the max latency expires).
+        // The writer wakes us up, so no need to poll.
+        buf_in.wait_available(reader_id,batch_size,max_latency_msec);
+
+        // Take the data from one ring buffer, one chunk at a time, and
+        // transform it into the other buffer through the stages, one tile at a
+        // time: the tiles stay in the cache, and only the last stage output is
+        // copied in the buffer
+        // (all those available up to 'max_io_points', but the output buffer could
+        // be smaller: never take more than what can be written to it)
+        size_t max_n= (buf_out.capacity()<max_io_points)? buf_out.capacity() : max_io_points;
+        max_n=max<size_t>(max_n/channels,1)*channels;
+        size_t lag=min<size_t>(buf_in.read_available(reader_id),total_points-j);
+        auto region_in =buf_in.acquire_read(reader_id,max_n);
+        size_t n_frames=region_in.size()/channels;
+        auto region_out=buf_out.reserve_write(pipeline.out_frames(n_frames)*channels);
+        n_frames=min<uint64_t>(n_frames,pipeline.max_in_frames(region_out.size()/channels));
+        size_t n=n_frames*channels;
+        uint64_t first=pipeline.input_frames();
+
+        // The input can be split in two parts, and the output too (at a different
+        // point): the frames output are copied one contiguous piece at a time
+        size_t n_out=0;
+        auto put=[&](const data_point_t* y,size_t m) {
+            for (size_t left=m*channels;left>0;) {
+                size_t n_contig;
+                data_point_t *dst=region_out.at(n_out,n_contig);
+                size_t c=min(n_contig,left);
+                copy(y,y+c,dst);
+                y+=c;
+                n_out+=c;
+                left-=c;
+            }
+        };
+        drain.read(n,lag);
+        size_t n1=min(n,region_in.n1);
+        pipeline.process(region_in.data1,n1/channels,put);
+        pipeline.process(region_in.data2,(n-n1)/channels,put);
+        j += n;
+
+        // If we have been too slow, the input data could have been overwritten
+        // while transforming it: the frames output from the first 'n_overwritten'
+        // points are corrupted. They are lost data (as when we are overrun): move
+        // the valid ones over them, and publish only those. (The state of the
+        // stages, e.g. the history of a filter, is corrupted for a few frames.)
+        size_t n_overwritten=buf_in.release_read(reader_id,n);
+        if (n_overwritten) {
+            size_t n_drop=pipeline.out_frames(first,min(n_frames,(n_overwritten+channels-1)/channels))*channels;
+            cerr << "Transformer: WARNING " << n_overwritten << " data points overwritten while transforming" << endl;
+            for (size_t k=0;k+n_drop<n_out;k++) {
+                size_t n_contig;
+                *region_out.at(k,n_contig)=*region_out.at(k+n_drop,n_contig);
+            }
+            n_out -= n_drop;
+        }
 
-    period_repeat(
+        buf_out.commit_write(n_out);
+    }
+
+    return j;
+}
 
-        INTERVAL_MSEC, // How frequently to repeat
 
-        // What to do each time
-        [&] {
-            data_point_t membuf[POINTS_PER_INTERVAL];
+/**
+ * Transforms the frames of 'buf_in' into 'buf_out' on 'n_workers' threads.
+ * This thread (the dispatcher) copies the input in blocks of up to 'block_frames'
+ * frames, in sequence, each transformed by a worker with a pipeline of its own
+ * (the block starts with the last frames of the previous one, see
+ * transform_pipeline::lookback()). The blocks transformed are written in the
+ * output in sequence (the reorder stage), as soon as all the previous ones are.
+ * Returns the points read.
+ */
+static size_t run_parallel(shm_ringbuf& buf_in,shm_ringbuf& buf_out,size_t channels,drain_stats& drain)
+{
+    struct block {
+        block(size_t channels) : pipeline(channels) {}
+
+        transform_pipeline   pipeline;
+        vector<data_point_t> in;          // 'n_look' frames before the block, then the block
+        vector<data_point_t> out;         // the frames output, 'n_look' frames included
+        uint64_t             first=0;     // index of the first frame of the block
+        size_t               n_look=0;
+        size_t               n_frames=0;
+        size_t               n_overwritten=0;   // frames at the start of the block
+        future<void>         done;
+    };
+
+    // A block for each block in flight, used in turn
+    const size_t max_in_flight=2*n_workers+1;
+    vector<unique_ptr<block>> blocks;
+    for (size_t k=0;k<max_in_flight;k++) {
+        blocks.emplace_back(new block(channels));
+        build_pipeline(blocks.back()->pipeline);
+    }
+    const size_t lookback=blocks[0]->pipeline.lookback();
+
+    // The blocks are never larger than the output buffer
+    size_t max_frames=max<size_t>(min<size_t>(block_frames,buf_out.capacity()/channels),1);
+
+    worker_pool pool(n_workers);
+    deque<block*> in_flight;
+    size_t next_block=0;
+
+    // Writes the first block in flight in the output (waits for it)
+    auto write_first=[&] {
+        block *b=in_flight.front();
+        in_flight.pop_front();
+        b->done.get();
+
+        // The frames output for the frames before the block and for those
+        // overwritten while copying are dropped
+        size_t n_drop=b->pipeline.out_frames(b->first-b->n_look,b->n_look+b->n_overwritten)*channels;
+        size_t n=b->out.size()-n_drop;
+        auto region=buf_out.reserve_write(n);
+        n=region.size()-region.size()%channels;
+        size_t n1=min(n,region.n1);
+        copy(b->out.begin()+n_drop,b->out.begin()+n_drop+n1,region.data1);
+        copy(b->out.begin()+n_drop+n1,b->out.begin()+n_drop+n,region.data2);
+        buf_out.commit_write(n);
+    };
+
+    uint64_t frame=0;             // next frame read
+    vector<data_point_t> tail;    // the last 'lookback' frames read
+    size_t total_points=size_t(seconds_to_run)*points_per_sec*channels;
+
+    while (frame*channels<total_points && !stop_requested) {
+        // Make room for the next block, and write those ready
+        while (!in_flight.empty() &&
+               (in_flight.size()>=max_in_flight ||
+                in_flight.front()->done.wait_for(chrono::seconds(0))==future_status::ready))
+            write_first();
+
+        buf_in.wait_available(reader_id,batch_size,max_latency_msec);
+        size_t n_read=min<size_t>(max_frames*channels,total_points-frame*channels);
+        size_t lag=min<size_t>(buf_in.read_available(reader_id),total_points-frame*channels);
+        auto region=buf_in.acquire_read(reader_id,n_read);
+        size_t n=region.size()-region.size()%channels;
+        drain.read(n,lag);
+        if (n==0) {
+            buf_in.release_read(reader_id,0);
+            continue;
+        }
 
-            // Read the data from one ring buffer, one chunk at a time
-            unsigned int n=buf_in.read(reader_id,membuf,POINTS_PER_INTERVAL);
+        // The block: the end of the previous one, then the frames read
+        block *b=blocks[next_block++%max_in_flight].get();
+        b->first=frame;
+        b->n_look=tail.size()/channels;
+        b->n_frames=n/channels;
+        b->in.resize(tail.size()+n);
+        copy(tail.begin(),tail.end(),b->in.begin());
+        size_t n1=min(n,region.n1);
+        copy(region.data1,region.data1+n1,b->in.begin()+tail.size());
+        copy(region.data2,region.data2+(n-n1),b->in.begin()+tail.size()+n1);
+
+        // (see run_serial())
+        size_t n_overwritten=buf_in.release_read(reader_id,n);
+        b->n_overwritten=min(b->n_frames,(n_overwritten+channels-1)/channels);
+        if (n_overwritten)
+            cerr << "Transformer: WARNING " << n_overwritten << " data points overwritten while transforming" << endl;
+        frame+=b->n_frames;
+
+        size_t n_tail=min<size_t>(lookback,b->in.size()/channels)*channels;
+        tail.assign(b->in.end()-n_tail,b->in.end());
+
+        auto task=make_shared<packaged_task<void()>>([b,channels] {
+            b->out.clear();
+            b->pipeline.seek(b->first-b->n_look);
+            b->pipeline.process(b->in.data(),b->n_look+b->n_frames,[b,channels](const data_point_t* y,size_t m) {
+                b->out.insert(b->out.end(),y,y+m*channels);
+            });
+        });
+        b->done=task->get_future();
+        in_flight.push_back(b);
+        pool.submit([task] { (*task)(); });
+    }
 
-            for (int k=0;k<n;k++)
-                membuf[k] = transform(j++,membuf[k]);
+    while (!in_flight.empty())
+        write_first();
+    return frame*channels;
+}
 
-            // Write to the other buffer
-            buf_out.write(membuf,n);
-        },
 
-        // Continue while this condition is true
-        [&j] {
-            return j < (seconds_to_run*POINTS_PER_SEC); // j < (Total points to generate) ?
-        }
-    );
+/**
+ * Transforms the points of the ring buffers of 'segment', as chosen with the command line
+ */
+template <typename SEGMENT>
+int run(SEGMENT& segment)
+{
+    shm_ringbuf  buf_in(ringbuf_in_name.c_str(),segment);
+    shm_ringbuf  buf_out(ringbuf_out_name.c_str(),segment);
+    size_t channels=get_channels(segment);
+
+    try {
+        set_thread_scheduling(fifo_priority,cpus);
+    } catch (std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return -1;
+    }
+
+    // Check the stages before starting
+    try {
+        transform_pipeline pipeline(channels);
+        build_pipeline(pipeline);
+    } catch (std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return -1;
+    }
+
+    // Attach as a reader of the input, with the given Id or the first free one
+    try {
+        if (any_reader_id)
+            reader_id=buf_in.attach_reader(start,critical);
+        else
+            buf_in.attach_reader(reader_id,start,critical);
+    } catch (std::exception &e) {
+        cerr << "ERROR: " << e.what() << endl;
+        return -1;
+    }
+
+    auto t0=chrono::steady_clock::now();
+    drain_stats drain;
+    size_t n_points= n_workers? run_parallel(buf_in,buf_out,channels,drain) : run_serial(buf_in,buf_out,channels,drain);
+    double sec=chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+
+    if (!quiet) {
+        cout << "Transformer: " << n_points << " data points in " << sec << " s: " << n_points/sec/1e6 << " Mpoints/s ("
+             << (n_workers? to_string(n_workers)+" workers" : string("serial")) << ")" << endl;
+        cout << "Transformer: " << drain.summary() << endl;
+    }
 
     return 0;
 }
 
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc,argv);
+
+    // Setup for the ring buffers, which must have been ALREDAY CREATED (this
+    // just opens them)
+    interprocess::managed_shared_memory segment(interprocess::open_only, SHARED_MEM_NAME);
+    return run(segment);
+}
+
 /**
  * Parsing command line arguments, using BOOST.
  * See BOOST documentation for details.
@@ -94,9 +364,22 @@ void parse_args(int argc,char *argv[])
     desc.add_options()
         ("help", "write this help message")
         ("inbuf", po::value<string>() ,"name of the input ringbuffer")
-        ("id", po::value<unsigned int>(), "reader Id for the input ring buffer")
+        ("id", po::value<unsigned int>(), "reader Id for the input ring buffer (default: the first free one)")
+        ("head", "start reading the data written from now on (default: the oldest data in the buffer)")
+        ("critical", "attach as a critical reader: depending on the overflow policy of the ring buffer, the writer waits for us or drops new data instead of overwriting ours")
         ("outbuf", po::value<string>() ,"name of the output ringbuffer")
         ("seconds", po::value<unsigned int>(), "how many seconds to run")
+        ("rate", po::value<unsigned int>(), "frames per second of the generator (default: POINTS_PER_SEC)")
+        ("batch", po::value<unsigned int>(), "how many data points to wait for before reading")
+        ("latency", po::value<unsigned int>(), "max time to wait for data (msec)")
+        ("max-io", po::value<size_t>(), "max data points per read, when more are available (default: 8 intervals of POINTS_PER_SEC; with --workers the reads are blocks)")
+        ("stage", po::value<vector<string>>(), "a transform stage, e.g. 'gain:2', 'fir:0.25,0.5,0.25', 'decimate:2' (see transform_stages.h). Can be repeated: the stages are applied in order (default: 'transform', the transform() of cmn.h)")
+        ("stages", po::value<string>(), "a file with transform stages, one per line, applied after those of --stage")
+        ("workers", po::value<unsigned int>(), "transform blocks of frames in parallel on this many threads, and write them in order (default: 0, all in the main thread)")
+        ("block", po::value<size_t>(), "with --workers, max frames per block (default: 16384)")
+        ("quiet", "don't print the throughput at the end")
+        ("fifo", po::value<int>(), "run with this SCHED_FIFO real-time priority (1..99)")
+        ("cpus", po::value<string>(), "run on these cpus (e.g. 0,2)")
     ;
 
     po::variables_map vm;
@@ -122,9 +405,71 @@ void parse_args(int argc,char *argv[])
         exit(-1);
     }
 
-    if (vm.count("id"))
+    if (vm.count("id")) {
         reader_id= vm["id"].as<unsigned int>();
+        any_reader_id= false;
+    }
+
+    if (vm.count("head"))
+        start= swmr_start::head;
+
+    if (vm.count("critical"))
+        critical= true;
 
     if (vm.count("seconds"))
         seconds_to_run= vm["seconds"].as<unsigned int>();
-}
\ No newline at end of file
+
+    if (vm.count("rate"))
+        points_per_sec= vm["rate"].as<unsigned int>();
+
+    if (vm.count("batch"))
+        batch_size= vm["batch"].as<unsigned int>();
+
+    if (vm.count("latency"))
+        max_latency_msec= vm["latency"].as<unsigned int>();
+
+    if (vm.count("max-io")) {
+        max_io_points= vm["max-io"].as<size_t>();
+        if (max_io_points==0) {
+            cerr << "ERROR: the max I/O size must be > 0" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("stage"))
+        stages= vm["stage"].as<vector<string>>();
+
+    if (vm.count("stages"))
+        stages_file= vm["stages"].as<string>();
+
+    if (vm.count("workers"))
+        n_workers= vm["workers"].as<unsigned int>();
+
+    if (vm.count("block")) {
+        block_frames= vm["block"].as<size_t>();
+        if (block_frames==0) {
+            cerr << "ERROR: the block size must be > 0" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("quiet"))
+        quiet= true;
+
+    if (vm.count("fifo")) {
+        fifo_priority= vm["fifo"].as<int>();
+        if (fifo_priority<1 || fifo_priority>99) {
+            cerr << "ERROR: the SCHED_FIFO priority must be 1..99" << endl;
+            exit(-1);
+        }
+    }
+
+    if (vm.count("cpus")) {
+        try {
+            cpus= parse_cpu_list(vm["cpus"].as<string>());
+        } catch (std::exception &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            exit(-1);
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef __WORKER_POOL
+#define __WORKER_POOL
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+
+/**
+ * A fixed number of worker threads running the tasks submitted to them.
+ */
+class worker_pool {
+public:
+    worker_pool(unsigned int n_threads)
+    {
+        for (unsigned int k=0;k<n_threads;k++)
+            threads.emplace_back([this] { run(); });
+    }
+
+    ~worker_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping=true;
+        }
+        cond.notify_all();
+        for (auto &t : threads)
+            t.join();
+    }
+
+    size_t size() const { return threads.size(); }
+
+    /// Runs 'task' on one of the threads (on the calling thread if there are none)
+    void submit(std::function<void()> task)
+    {
+        if (threads.empty()) {
+            task();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push(std::move(task));
+        }
+        cond.notify_one();
+    }
+
+private:
+    void run()
+    {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock,[this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task=std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread>          threads;
+    std::queue<std::function<void()>> tasks;
+    std::mutex                        mutex;
+    std::condition_variable           cond;
+    bool                              stopping=false;
+};
+
+#endif